@@ -15,156 +15,1550 @@
 #pragma once
 #endif
 
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
 #include <iterator>
 #include <optional>
+#include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
+
+#if defined(TRANSRANGERS_SIMD)
+#include <experimental/simd>
+#endif
 
 #define TRANSRANGERS_FWD(x) std::forward<decltype(x)>(x)
 
 namespace transrangers{
 
-template<typename Cursor,typename F> 
-struct ranger_class:F
+template<typename Cursor,typename F> 
+struct ranger_class:F
+{
+  using cursor=Cursor;
+  using stage=F;
+};
+    
+template<typename Cursor,typename F>
+constexpr auto ranger(F f)
+{
+  return ranger_class<Cursor,F>{f};
+}
+
+template<typename T,typename=void>
+struct is_ranger:std::false_type{};
+
+template<typename T>
+struct is_ranger<T,std::void_t<typename T::cursor>>:std::true_type{};
+
+template<typename T>
+constexpr bool is_ranger_v=is_ranger<T>::value;
+
+/* Stage descriptors: the function object of a ranger built by the library is
+ * a named class template (its stage) exposing kind (a tag), args (the types
+ * of its non-ranger arguments) and sources (the types of its input rangers),
+ * with the corresponding values as public members. Rangers built from
+ * arbitrary lambdas with ranger<Cursor>(f) are opaque.
+ */
+
+struct opaque_tag{};
+struct all_tag{};
+struct filter_tag{};
+struct transform_tag{};
+struct transform_stateful_tag{};
+struct take_tag{};
+struct concat_tag{};
+struct unique_tag{};
+struct unique_by_tag{};
+struct join_tag{};
+
+template<typename Stage,typename=void>
+struct stage_traits
+{
+  using kind=opaque_tag;
+  using args=std::tuple<>;
+  using sources=std::tuple<>;
+};
+
+template<typename Stage>
+struct stage_traits<Stage,std::void_t<typename Stage::kind>>
+{
+  using kind=typename Stage::kind;
+  using args=typename Stage::args;
+  using sources=typename Stage::sources;
+};
+
+template<typename Ranger,typename=void>
+struct ranger_stage{using type=void;};
+
+template<typename Ranger>
+struct ranger_stage<Ranger,std::void_t<typename Ranger::stage>>
+{
+  using type=typename Ranger::stage;
+};
+
+template<typename Ranger>
+using stage_t=typename ranger_stage<Ranger>::type;
+
+template<typename Cursor,typename F>
+constexpr F& stage_of(ranger_class<Cursor,F>& rgr){return rgr;}
+
+template<typename Ranger>
+using stage_kind_t=typename stage_traits<stage_t<Ranger>>::kind;
+
+template<typename Ranger>
+using stage_args_t=typename stage_traits<stage_t<Ranger>>::args;
+
+template<typename Ranger>
+using stage_sources_t=typename stage_traits<stage_t<Ranger>>::sources;
+    
+/* Block protocol: a block ranger additionally exposes blocks(bdst), where
+ * bdst(const T* p,std::size_t n) receives up to block_size contiguous values
+ * at a time and returns false to stop. Blocks are always consumed whole;
+ * when used as a regular ranger, values are pushed one by one through
+ * value_cursors.
+ *
+ * Buffering stages (block rangers, branchless_filter, lookup stages) pull
+ * values from upstream ahead of their consumer. Those not yet pushed when
+ * the consumer stops are kept and pushed first on the next invocation, so
+ * resuming such a ranger doesn't skip elements.
+ */
+
+constexpr std::size_t block_size=64;
+
+template<typename T>
+struct value_cursor
+{
+  constexpr T operator*()const{return x;}
+
+  T x;
+};
+
+template<typename T,typename F>
+struct block_ranger_class
+{
+  using cursor=value_cursor<T>;
+  using stage=F;
+
+  template<typename BlockDst>
+  constexpr bool blocks(BlockDst&& bdst)
+  {
+    if(pfirst!=plast){
+      auto first=pfirst,n=plast-pfirst;
+      pfirst=plast=0;
+      if(!bdst(static_cast<const T*>(pending+first),n))return false;
+    }
+    return f(bdst);
+  }
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    while(pfirst!=plast)if(!dst(cursor{pending[pfirst++]}))return false;
+    return f([&](const T* p,std::size_t n){
+      for(std::size_t i=0;i<n;++i){
+        if(!dst(cursor{p[i]})){
+          std::copy(p+i+1,p+n,pending);
+          pfirst=0;
+          plast=n-i-1;
+          return false;
+        }
+      }
+      return true;
+    });
+  }
+
+  F           f;
+  T           pending[block_size]={};
+  std::size_t pfirst=0,plast=0;
+};
+
+template<typename T,typename F>
+constexpr auto block_ranger(F f)
+{
+  return block_ranger_class<T,F>{f};
+}
+
+template<typename T,typename F>
+constexpr F& stage_of(block_ranger_class<T,F>& rgr){return rgr.f;}
+
+template<typename Ranger>
+struct is_block_ranger:std::false_type{};
+
+template<typename T,typename F>
+struct is_block_ranger<block_ranger_class<T,F>>:std::true_type{};
+
+template<typename Ranger>
+constexpr bool is_block_ranger_v=is_block_ranger<Ranger>::value;
+
+template<typename Iterator>
+struct all_fun
+{
+  using kind=all_tag;
+  using args=std::tuple<Iterator>;
+  using sources=std::tuple<>;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    while(first!=last)if(!dst(first++))return false;
+    return true;
+  }
+
+  Iterator first,last;
+};
+
+template<typename Range>
+constexpr auto all(Range&& rng)
+{
+  using std::begin;
+  using std::end;
+  using cursor=decltype(begin(rng));
+  
+  return ranger<cursor>(all_fun<cursor>{begin(rng),end(rng)});
+}
+
+/* block_value_t<Ranger> is the value type of the blocks Ranger can produce,
+ * or void if it can't: block rangers and all() (or sources whose stage
+ * derives from all_fun) over contiguous sequences of arithmetic values
+ * qualify.
+ */
+
+template<typename Ranger>
+struct block_value{using type=void;};
+
+template<typename T,typename F>
+struct block_value<block_ranger_class<T,F>>{using type=T;};
+
+template<typename Iterator,typename F>
+requires std::is_base_of_v<all_fun<Iterator>,F>
+struct block_value<ranger_class<Iterator,F>>
+{
+  using type=std::conditional_t<
+    std::contiguous_iterator<Iterator>&&
+    std::is_arithmetic_v<std::iter_value_t<Iterator>>,
+    std::iter_value_t<Iterator>,void>;
+};
+
+template<typename Ranger>
+using block_value_t=typename block_value<Ranger>::type;
+
+template<typename T,typename F>
+constexpr auto as_block_ranger(block_ranger_class<T,F> rgr)
+{
+  return rgr;
+}
+
+template<typename Iterator>
+struct all_block_fun
+{
+  using kind=all_tag;
+  using args=std::tuple<Iterator>;
+  using sources=std::tuple<>;
+
+  template<typename BlockDst>
+  constexpr bool operator()(BlockDst&& bdst)
+  {
+    while(first!=last){
+      auto n=static_cast<std::size_t>(
+        std::min<std::ptrdiff_t>(block_size,last-first));
+      auto p=std::to_address(first);
+      first+=n;
+      if(!bdst(p,n))return false;
+    }
+    return true;
+  }
+
+  Iterator first,last;
+};
+
+template<typename Iterator,typename F>
+requires std::is_base_of_v<all_fun<Iterator>,F>
+constexpr auto as_block_ranger(ranger_class<Iterator,F> rgr)
+{
+  using value_type=std::iter_value_t<Iterator>;
+
+  return block_ranger<value_type>(all_block_fun<Iterator>{rgr.first,rgr.last});
+}
+      
+/* Block kernels. With TRANSRANGERS_SIMD defined, functions invocable with a
+ * simd<T> argument are fed full native vectors, the tail of each block going
+ * through the scalar overload if there's one, or else through a vector padded
+ * with copies of the tail's first element. transform functions must return a
+ * simd of the same width and filter predicates a simd_mask. Note that generic
+ * callables are then required to be well-formed for simd arguments.
+ */
+
+/* simd<T> is implicitly constructible from T, so a function taking simd<T>
+ * is also invocable with T; only the result type tells them apart.
+ */
+
+template<typename F,typename T>
+constexpr bool is_scalar_transform()
+{
+  if constexpr(!std::is_invocable_v<F&,const T&>)return false;
+  else return std::is_arithmetic_v<std::invoke_result_t<F&,const T&>>;
+}
+
+template<typename F,typename T>
+constexpr bool is_scalar_filter()
+{
+  if constexpr(!std::is_invocable_v<F&,const T&>)return false;
+  else return std::is_convertible_v<std::invoke_result_t<F&,const T&>,bool>;
+}
+
+#if defined(TRANSRANGERS_SIMD)
+template<typename T>
+using simd=std::experimental::native_simd<T>;
+
+template<typename T>
+constexpr bool is_simd_vectorizable=
+  std::is_arithmetic_v<T>&&!std::is_same_v<T,bool>;
+
+template<typename F,typename T>
+constexpr bool is_simd_transform()
+{
+  if constexpr(!is_simd_vectorizable<T>)return false;
+  else if constexpr(!std::is_invocable_v<F&,const simd<T>&>)return false;
+  else{
+    using result_type=std::invoke_result_t<F&,const simd<T>&>;
+    
+    if constexpr(!std::experimental::is_simd_v<result_type>)return false;
+    else return result_type::size()==simd<T>::size();
+  }
+}
+
+template<typename F,typename T>
+constexpr bool is_simd_filter()
+{
+  if constexpr(!is_simd_vectorizable<T>)return false;
+  else if constexpr(!std::is_invocable_v<F&,const simd<T>&>)return false;
+  else return std::is_same_v<
+    std::invoke_result_t<F&,const simd<T>&>,typename simd<T>::mask_type>;
+}
+#else
+template<typename F,typename T>
+constexpr bool is_simd_transform(){return false;}
+
+template<typename F,typename T>
+constexpr bool is_simd_filter(){return false;}
+#endif
+
+template<typename F,typename T>
+struct block_result
+{
+  using type=std::invoke_result_t<F&,const T&>;
+};
+
+#if defined(TRANSRANGERS_SIMD)
+template<typename F,typename T>
+requires(is_simd_transform<F,T>())
+struct block_result<F,T>
+{
+  using type=typename std::invoke_result_t<F&,const simd<T>&>::value_type;
+};
+#endif
+
+template<typename F,typename T>
+using block_result_t=typename block_result<F,T>::type;
+
+/* Runtime ISA dispatch. On x86 with GCC or Clang, dispatch<Kernel> runs a
+ * kernel compiled for baseline x86-64, AVX2 or AVX-512, as detected at
+ * startup, so that auto-vectorized loops use the widest registers
+ * available. Only the kernels of count_if and find_if over all() sources,
+ * run once over the whole range, are dispatched; block kernels run inline
+ * at the ISA the program is compiled for. force_isa_level lowers the level
+ * (e.g. for benchmarking each variant) and is capped at the detected one.
+ * Note that simd<T> widths are fixed at compile time regardless.
+ */
+
+enum class isa_level{generic=0,avx2,avx512};
+
+#if (defined(__GNUC__)||defined(__clang__))&&\
+    (defined(__x86_64__)||defined(__i386__))&&\
+    !defined(TRANSRANGERS_NO_ISA_DISPATCH)
+#define TRANSRANGERS_ISA_DISPATCH
+#define TRANSRANGERS_FORCEINLINE __attribute__((always_inline)) inline
+#define TRANSRANGERS_TARGET_AVX2 \
+  __attribute__((target("avx2,bmi,bmi2,popcnt")))
+#define TRANSRANGERS_TARGET_AVX512 \
+  __attribute__((target("avx512f,avx512bw,avx512vl,avx512dq,avx2,bmi,bmi2,popcnt")))
+
+inline isa_level detected_isa_level()
+{
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")&&__builtin_cpu_supports("avx512bw")&&
+     __builtin_cpu_supports("avx512vl")&&__builtin_cpu_supports("avx512dq")){
+    return isa_level::avx512;
+  }
+  if(__builtin_cpu_supports("avx2"))return isa_level::avx2;
+  return isa_level::generic;
+}
+
+/* dynamically initialized; kernels run before that see generic */
+inline isa_level active_isa_level=detected_isa_level();
+
+inline isa_level current_isa_level(){return active_isa_level;}
+
+inline void force_isa_level(isa_level l)
+{
+  active_isa_level=std::min(l,detected_isa_level());
+}
+
+template<typename Kernel,typename... Args>
+TRANSRANGERS_TARGET_AVX2 auto dispatch_avx2(Args&&... args)
+{
+  return Kernel::run(TRANSRANGERS_FWD(args)...);
+}
+
+template<typename Kernel,typename... Args>
+TRANSRANGERS_TARGET_AVX512 auto dispatch_avx512(Args&&... args)
+{
+  return Kernel::run(TRANSRANGERS_FWD(args)...);
+}
+#else
+#define TRANSRANGERS_FORCEINLINE inline
+
+inline isa_level current_isa_level(){return isa_level::generic;}
+inline void      force_isa_level(isa_level){}
+#endif
+
+template<typename Kernel,typename... Args>
+auto dispatch(Args&&... args)
+{
+#if defined(TRANSRANGERS_ISA_DISPATCH)
+  switch(active_isa_level){
+    case isa_level::avx512:
+      return dispatch_avx512<Kernel>(TRANSRANGERS_FWD(args)...);
+    case isa_level::avx2:
+      return dispatch_avx2<Kernel>(TRANSRANGERS_FWD(args)...);
+    default:;
+  }
+#endif
+  return Kernel::run(TRANSRANGERS_FWD(args)...);
+}
+
+struct transform_block_kernel
+{
+  template<typename F,typename T,typename R>
+  static TRANSRANGERS_FORCEINLINE
+  void run(F& f,const T* p,R (&out)[block_size],std::size_t n)
+  {
+#if defined(TRANSRANGERS_SIMD)
+    if constexpr(is_simd_transform<F,T>()){
+      namespace stdx=std::experimental;
+      constexpr std::size_t w=simd<T>::size();
+
+      std::size_t i=0;
+      for(;i+w<=n;i+=w){
+        f(simd<T>(p+i,stdx::element_aligned)).copy_to(out+i,stdx::element_aligned);
+      }
+      if constexpr(is_scalar_transform<F,T>()){
+        for(;i<n;++i)out[i]=f(p[i]);
+      }
+      else if(i<n){
+        T tail[w];
+        R res[w];
+        std::fill(std::copy(p+i,p+n,tail),tail+w,p[i]);
+        f(simd<T>(tail,stdx::element_aligned)).copy_to(res,stdx::element_aligned);
+        std::copy(res,res+(n-i),out+i);
+      }
+    }
+    else
+#endif
+    for(std::size_t i=0;i<n;++i)out[i]=f(p[i]);
+  }
+};
+
+/* simd is not usable in constant evaluation, where block kernels fall back
+ * to plain loops over the scalar overload. transform_block takes its output
+ * as an array so that the compiler knows the trip count is at most
+ * block_size and fully unrolls the loop into the consumer's.
+ */
+
+template<typename F,typename T,typename R>
+constexpr void transform_block(
+  F& f,const T* p,R (&out)[block_size],std::size_t n)
+{
+  if constexpr(is_scalar_transform<F,T>()){
+    if(std::is_constant_evaluated()){
+      for(std::size_t i=0;i<n;++i)out[i]=f(p[i]);
+      return;
+    }
+  }
+  transform_block_kernel::run(f,p,out,n);
+}
+
+struct filter_block_kernel
+{
+  template<typename Pred,typename T>
+  static TRANSRANGERS_FORCEINLINE
+  std::size_t run(Pred& pred,const T* p,T* out,std::size_t n)
+  {
+    std::size_t m=0;
+#if defined(TRANSRANGERS_SIMD)
+    if constexpr(is_simd_filter<Pred,T>()){
+      namespace stdx=std::experimental;
+      constexpr std::size_t w=simd<T>::size();
+
+      auto compact=[&](const T* q,const typename simd<T>::mask_type& mask,
+                       std::size_t k){
+        if(stdx::none_of(mask))return;
+        if(k==w&&stdx::all_of(mask)){
+          std::copy(q,q+w,out+m);
+          m+=w;
+        }
+        else{
+          bool sel[w];
+          mask.copy_to(sel,stdx::element_aligned);
+          for(std::size_t j=0;j<k;++j){
+            out[m]=q[j];
+            m+=sel[j];
+          }
+        }
+      };
+
+      std::size_t i=0;
+      for(;i+w<=n;i+=w)compact(p+i,pred(simd<T>(p+i,stdx::element_aligned)),w);
+      if constexpr(is_scalar_filter<Pred,T>()){
+        for(;i<n;++i){
+          out[m]=p[i];
+          m+=static_cast<bool>(pred(p[i]));
+        }
+      }
+      else if(i<n){
+        T tail[w];
+        std::fill(std::copy(p+i,p+n,tail),tail+w,p[i]);
+        compact(tail,pred(simd<T>(tail,stdx::element_aligned)),n-i);
+      }
+    }
+    else
+#endif
+    for(std::size_t i=0;i<n;++i)if(pred(p[i]))out[m++]=p[i];
+    return m;
+  }
+};
+
+template<typename Pred,typename T>
+constexpr std::size_t filter_block(Pred& pred,const T* p,T* out,std::size_t n)
+{
+  if constexpr(is_scalar_filter<Pred,T>()){
+    if(std::is_constant_evaluated()){
+      std::size_t m=0;
+      for(std::size_t i=0;i<n;++i)if(pred(p[i]))out[m++]=p[i];
+      return m;
+    }
+  }
+  return filter_block_kernel::run(pred,p,out,n);
+}
+
+/* unique_block writes to out the elements of p differing from their
+ * predecessor, prev for the first one, without branching on the outcome:
+ * with simd, each vector is first compared with the one starting an element
+ * before, so that vectors with no survivors are skipped and those with no
+ * duplicates copied whole.
+ */
+
+struct unique_block_kernel
+{
+  template<typename T>
+  static TRANSRANGERS_FORCEINLINE
+  std::size_t run(T prev,const T* p,T* out,std::size_t n)
+  {
+    std::size_t m=0,i=0;
+    if(n==0)return 0;
+    out[m]=p[0];
+    m+=!(prev==p[0]);
+#if defined(TRANSRANGERS_SIMD)
+    if constexpr(is_simd_vectorizable<T>){
+      namespace stdx=std::experimental;
+      constexpr std::size_t w=simd<T>::size();
+
+      for(i=1;i+w<=n;i+=w){
+        simd<T> x(p+i,stdx::element_aligned),y(p+i-1,stdx::element_aligned);
+        auto    eq=x==y;
+        if(stdx::all_of(eq))continue;
+        if(stdx::none_of(eq)){
+          std::copy(p+i,p+i+w,out+m);
+          m+=w;
+        }
+        else for(std::size_t j=i;j<i+w;++j){
+          out[m]=p[j];
+          m+=!(p[j-1]==p[j]);
+        }
+      }
+    }
+#endif
+    for(i=std::max<std::size_t>(i,1);i<n;++i){
+      out[m]=p[i];
+      m+=!(p[i-1]==p[i]);
+    }
+    return m;
+  }
+};
+
+template<typename T>
+constexpr std::size_t unique_block(T prev,const T* p,T* out,std::size_t n)
+{
+  if(std::is_constant_evaluated()){
+    std::size_t m=0;
+    for(std::size_t i=0;i<n;prev=p[i++])if(!(prev==p[i]))out[m++]=p[i];
+    return m;
+  }
+  return unique_block_kernel::run(prev,p,out,n);
+}
+
+/* Filter pushdown: filter(pred,rgr) hands pred over to the source when the
+ * source's stage advertises pushdown by providing push_down(pred), which
+ * returns a ranger producing exactly the source elements satisfying pred and
+ * can locate them without a full scan. Sources accept the range predicate
+ * forms between(lo,hi) (lo<=x<=hi), less_than(hi) (x<hi) and equal_to(x)
+ * (v==x), which are also usable as regular predicates and tell through
+ * may_match(min,max) whether some value in [min,max] can satisfy them.
+ * sorted_all(rng) is all(rng) for sequences sorted by operator<, narrowed by
+ * binary search.
+ */
+
+template<typename T>
+struct between_fun
+{
+  template<typename U>
+  constexpr auto operator()(const U& x)const{return !(x<lo)&&!(hi<x);}
+
+  template<typename U>
+  constexpr bool may_match(const U& min,const U& max)const
+  {
+    return !(max<lo)&&!(hi<min)&&!(hi<lo);
+  }
+
+  T lo,hi;
+};
+
+template<typename T>
+constexpr auto between(T lo,T hi)
+{
+  return between_fun<T>{lo,hi};
+}
+
+template<typename T>
+struct less_than_fun
+{
+  template<typename U>
+  constexpr auto operator()(const U& x)const{return x<hi;}
+
+  template<typename U>
+  constexpr bool may_match(const U& min,const U&)const{return min<hi;}
+
+  T hi;
+};
+
+template<typename T>
+constexpr auto less_than(T hi)
+{
+  return less_than_fun<T>{hi};
+}
+
+template<typename T>
+struct equal_to_fun
+{
+  template<typename U>
+  constexpr auto operator()(const U& v)const{return v==x;}
+
+  template<typename U>
+  constexpr bool may_match(const U& min,const U& max)const
+  {
+    return !(x<min)&&!(max<x);
+  }
+
+  T x;
+};
+
+template<typename T>
+constexpr auto equal_to(T x)
+{
+  return equal_to_fun<T>{x};
+}
+
+template<typename Pred,typename Ranger>
+constexpr bool is_pushdown_filter()
+{
+  return requires(Ranger& rgr,const Pred& pred){stage_of(rgr).push_down(pred);};
+}
+
+/* Binary search over random-access sequences with a fixed number of
+ * iterations and a conditional move in place of the branch on each
+ * comparison, which the CPU would mispredict half of the time.
+ */
+
+template<typename Iterator,typename Pred>
+constexpr Iterator branchless_partition_point(
+  Iterator first,Iterator last,Pred pred)
+{
+  if constexpr(!std::random_access_iterator<Iterator>){
+    return std::partition_point(first,last,pred);
+  }
+  else{
+    auto n=last-first;
+    if(n==0)return first;
+    while(n>1){
+      auto half=n/2;
+      first=pred(first[half])?first+half:first;
+      n-=half;
+    }
+    return first+pred(*first);
+  }
+}
+
+template<typename Iterator,typename T>
+constexpr Iterator branchless_lower_bound(
+  Iterator first,Iterator last,const T& x)
+{
+  return branchless_partition_point(
+    first,last,[&](const auto& y){return y<x;});
+}
+
+template<typename Iterator,typename T>
+constexpr Iterator branchless_upper_bound(
+  Iterator first,Iterator last,const T& x)
+{
+  return branchless_partition_point(
+    first,last,[&](const auto& y){return !(x<y);});
+}
+
+template<typename Iterator>
+struct sorted_all_fun:all_fun<Iterator>
+{
+  template<typename T>
+  constexpr auto push_down(const between_fun<T>& pred)const
+  {
+    auto first=branchless_lower_bound(this->first,this->last,pred.lo);
+
+    return narrowed(first,branchless_upper_bound(first,this->last,pred.hi));
+  }
+
+  template<typename T>
+  constexpr auto push_down(const less_than_fun<T>& pred)const
+  {
+    return narrowed(
+      this->first,branchless_lower_bound(this->first,this->last,pred.hi));
+  }
+
+  template<typename T>
+  constexpr auto push_down(const equal_to_fun<T>& pred)const
+  {
+    auto first=branchless_lower_bound(this->first,this->last,pred.x);
+
+    return narrowed(first,branchless_upper_bound(first,this->last,pred.x));
+  }
+
+  static constexpr auto narrowed(Iterator first,Iterator last)
+  {
+    return ranger<Iterator>(sorted_all_fun{{first,last}});
+  }
+};
+
+template<typename Range>
+constexpr auto sorted_all(Range&& rng)
+{
+  using std::begin;
+  using std::end;
+  using cursor=decltype(begin(rng));
+
+  return sorted_all_fun<cursor>::narrowed(begin(rng),end(rng));
+}
+
+/* sorted_range(rng,lo,hi) and equal_range_all(rng,key) stream the elements
+ * x of a sorted range with lo<=x<hi and !(x<key)&&!(key<x), respectively.
+ */
+
+template<typename Range,typename T>
+constexpr auto sorted_range(Range&& rng,const T& lo,const T& hi)
+{
+  using std::begin;
+  using std::end;
+  using cursor=decltype(begin(rng));
+
+  auto first=branchless_lower_bound(begin(rng),end(rng),lo);
+  return sorted_all_fun<cursor>::narrowed(
+    first,branchless_lower_bound(first,end(rng),hi));
+}
+
+template<typename Range,typename T>
+constexpr auto equal_range_all(Range&& rng,const T& key)
+{
+  using std::begin;
+  using std::end;
+  using cursor=decltype(begin(rng));
+
+  auto first=branchless_lower_bound(begin(rng),end(rng),key);
+  return sorted_all_fun<cursor>::narrowed(
+    first,branchless_upper_bound(first,end(rng),key));
+}
+
+/* indexed_all(rng,block) is all(rng) over a random-access range along with
+ * the min and max values of each run of block elements (its zone map),
+ * computed once and shared by copies of the ranger; indexed_all(rng,zmap)
+ * reuses a zone map previously obtained from stage_of(rgr).zmap, which must
+ * have been computed over a range of the same size (and contents). Block
+ * sizes of 0 are taken as 1. Pushed-down predicates skip blocks that can't
+ * match, which pays off when data is roughly clustered (e.g. time series).
+ */
+
+template<typename T>
+struct zone_map
+{
+  std::size_t    block;
+  std::vector<T> mins,maxs;
+};
+
+template<typename Iterator>
+auto make_zone_map(Iterator first,Iterator last,std::size_t block)
+{
+  using value_type=std::iter_value_t<Iterator>;
+
+  auto zmap=std::make_shared<zone_map<value_type>>();
+  zmap->block=std::max<std::size_t>(block,1);
+  while(first!=last){
+    auto next=first+std::min<std::ptrdiff_t>(zmap->block,last-first);
+    auto min=*first,max=*first;
+    for(;first!=next;++first){
+      min=std::min(min,*first);
+      max=std::max(max,*first);
+    }
+    zmap->mins.push_back(min);
+    zmap->maxs.push_back(max);
+  }
+  return std::shared_ptr<const zone_map<value_type>>(std::move(zmap));
+}
+
+template<typename Iterator,typename Pred>
+struct indexed_filter_fun
+{
+  using zone_map_type=zone_map<std::iter_value_t<Iterator>>;
+
+  template<typename Dst>
+  bool operator()(Dst&& dst)
+  {
+    while(i<n){
+      auto b=i/zmap->block,
+           bend=std::min(n,(b+1)*zmap->block);
+      if(!pred.may_match(zmap->mins[b],zmap->maxs[b])){
+        i=bend;
+        continue;
+      }
+      while(i<bend){
+        auto p=origin+i++;
+        if(pred(*p)&&!dst(p))return false;
+      }
+    }
+    return true;
+  }
+
+  Iterator                             origin;
+  std::size_t                          i,n;
+  Pred                                 pred;
+  std::shared_ptr<const zone_map_type> zmap;
+};
+
+template<typename Iterator>
+struct indexed_all_fun:all_fun<Iterator>
+{
+  using zone_map_type=zone_map<std::iter_value_t<Iterator>>;
+
+  template<typename Pred>
+  requires requires(const Pred& pred,const std::iter_value_t<Iterator>& x){
+    pred.may_match(x,x);
+  }
+  auto push_down(const Pred& pred)const
+  {
+    return ranger<Iterator>(indexed_filter_fun<Iterator,Pred>{
+      origin,
+      static_cast<std::size_t>(this->first-origin),
+      static_cast<std::size_t>(this->last-origin),
+      pred,zmap});
+  }
+
+  Iterator                             origin;
+  std::shared_ptr<const zone_map_type> zmap;
+};
+
+template<typename Range,typename T>
+auto indexed_all(Range&& rng,std::shared_ptr<const zone_map<T>> zmap)
+{
+  using std::begin;
+  using std::end;
+  using cursor=decltype(begin(rng));
+  static_assert(std::random_access_iterator<cursor>,
+    "indexed_all requires a random-access range");
+  assert(
+    zmap&&zmap->block>0&&
+    zmap->mins.size()==
+      (static_cast<std::size_t>(end(rng)-begin(rng))+zmap->block-1)/
+      zmap->block);
+
+  return ranger<cursor>(indexed_all_fun<cursor>{
+    {begin(rng),end(rng)},begin(rng),std::move(zmap)});
+}
+
+template<typename Range>
+auto indexed_all(Range&& rng,std::size_t block)
+{
+  using std::begin;
+  using std::end;
+
+  return indexed_all(
+    TRANSRANGERS_FWD(rng),make_zone_map(begin(rng),end(rng),block));
+}
+
+template<typename Pred,typename Ranger>
+struct block_filter_fun
+{
+  using kind=filter_tag;
+  using args=std::tuple<Pred>;
+  using sources=std::tuple<Ranger>;
+  using value_type=block_value_t<Ranger>;
+
+  template<typename BlockDst>
+  constexpr bool operator()(BlockDst&& bdst)
+  {
+    return rgr.blocks([&](const value_type* p,std::size_t n){
+      value_type buf[block_size];
+      auto       m=filter_block(pred,p,buf,n);
+      return m?bdst(static_cast<const value_type*>(buf),m):true;
+    });
+  }
+
+  Pred   pred;
+  Ranger rgr;
+};
+
+template<typename Pred,typename Ranger>
+constexpr auto block_filter(Pred pred,Ranger rgr)
+{
+  using value_type=block_value_t<Ranger>;
+
+  return block_ranger<value_type>(block_filter_fun<Pred,Ranger>{pred,rgr});
+}
+
+template<typename Pred,typename Ranger>
+struct filter_fun
+{
+  using kind=filter_tag;
+  using args=std::tuple<Pred>;
+  using sources=std::tuple<Ranger>;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    return rgr([&](auto p){
+      return pred(*p)?dst(p):true;
+    });
+  }
+
+  Pred   pred;
+  Ranger rgr;
+};
+
+template<typename Pred,typename Ranger>
+constexpr auto filter(Pred pred,Ranger rgr)
+{
+  if constexpr(is_pushdown_filter<Pred,Ranger>()){
+    return stage_of(rgr).push_down(pred);
+  }
+  else if constexpr(is_simd_filter<Pred,block_value_t<Ranger>>()){
+    return block_filter(pred,as_block_ranger(rgr));
+  }
+  else{
+    using cursor=typename Ranger::cursor;
+    
+    return ranger<cursor>(filter_fun<Pred,Ranger>{pred,rgr});
+  }
+}
+
+/* branchless_filter(pred,rgr) is a filter for predicates that defeat both
+ * vectorization and branch prediction: each cursor is written to a buffer
+ * unconditionally and the write position advanced by pred's result, and
+ * survivors are pushed downstream every block_size of them, so that the
+ * cost per element doesn't depend on selectivity. Plain filter remains
+ * faster when the compiler can turn the whole pipeline into conditional
+ * moves (e.g. summing the survivors). It is a buffering stage (see the
+ * block protocol). Cursors of rgr must be default constructible.
+ */
+
+template<typename Pred,typename Ranger>
+struct branchless_filter_fun
+{
+  using kind=filter_tag;
+  using args=std::tuple<Pred>;
+  using sources=std::tuple<Ranger>;
+  using cursor=typename Ranger::cursor;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    if(!flush(dst))return false;
+    if(!rgr([&](auto p){
+      buf[m]=p;
+      m+=static_cast<bool>(pred(*p));
+      return m<block_size||flush(dst);
+    }))return false;
+    return flush(dst);
+  }
+
+  template<typename Dst>
+  constexpr bool flush(Dst& dst)
+  {
+    while(pfirst!=m)if(!dst(buf[pfirst++]))return false;
+    pfirst=m=0;
+    return true;
+  }
+
+  Pred        pred;
+  Ranger      rgr;
+  cursor      buf[block_size]={};
+  std::size_t m=0,pfirst=0;
+};
+
+template<typename Pred,typename Ranger>
+constexpr auto branchless_filter(Pred pred,Ranger rgr)
+{
+  using cursor=typename Ranger::cursor;
+
+  return ranger<cursor>(branchless_filter_fun<Pred,Ranger>{pred,rgr});
+}
+
+template<typename Stage>
+struct is_branchless_filter_stage:std::false_type{};
+
+template<typename Pred,typename Ranger>
+struct is_branchless_filter_stage<branchless_filter_fun<Pred,Ranger>>:
+  std::true_type{};
+
+template<typename Ranger>
+constexpr bool is_branchless_filter()
+{
+  return is_branchless_filter_stage<stage_t<Ranger>>::value;
+}
+
+/* Function handles for transform cursors, which must stay valid when the
+ * ranger they come from is copied or moved so that they can be buffered.
+ * Small trivially copyable functions (lambdas capturing references,
+ * scalars or short arrays) are copied into each cursor, taking no space if
+ * empty, and are usable in constant expressions. Other functions, either
+ * costly to copy (e.g. capturing a std::vector) or making cursors large
+ * (e.g. capturing a big lookup table), are allocated once by transform as
+ * shared_funs, shared by all copies of the ranger (including those run in
+ * parallel), and cursors point to them; such transforms can't be constant
+ * evaluated. Copies of a function made by cursors don't see each other's
+ * state changes: stateful functions should go through transform_stateful.
+ * Const cursors (as buffered by lookup stages) can be dereferenced if the
+ * function is const-invocable.
+ */
+
+template<typename F>
+constexpr bool is_boxable_fun()
+{
+  return
+    std::is_trivially_copyable_v<F>&&sizeof(F)<=16*sizeof(void*);
+}
+
+/* default constructible and assignable even if F isn't (as with lambdas
+ * with captures); a default constructed fun_box holds no F and can only be
+ * assigned to.
+ */
+template<typename F>
+struct fun_box
+{
+  constexpr fun_box(){}
+  constexpr fun_box(const F& f):f{f}{}
+  constexpr fun_box(const fun_box&)=default;
+
+  constexpr fun_box& operator=(const fun_box& x)
+  {
+    std::construct_at(&f,x.f);
+    return *this;
+  }
+
+  constexpr F&       get(){return f;}
+  constexpr const F& get()const{return f;}
+
+  union{F f;};
+};
+
+template<typename F>
+requires(std::is_empty_v<F>&&std::is_default_constructible_v<F>)
+struct fun_box<F>
+{
+  constexpr fun_box(){}
+  constexpr fun_box(const F&){}
+
+  constexpr F get()const{return F{};}
+};
+
+template<typename F>
+struct shared_fun
+{
+  template<typename... Args>
+  decltype(auto) operator()(Args&&... args)const
+  {
+    return (*pf)(TRANSRANGERS_FWD(args)...);
+  }
+
+  std::shared_ptr<F> pf;
+};
+
+template<typename F>
+struct fun_ptr
+{
+  constexpr fun_ptr(){}
+  constexpr fun_ptr(F& f):pf{&f}{}
+  fun_ptr(const shared_fun<F>& f):pf{f.pf.get()}{}
+
+  constexpr F& get()const{return *pf;}
+
+  F* pf=nullptr;
+};
+
+template<typename F>
+struct fun_handle
+{
+  using type=std::conditional_t<is_boxable_fun<F>(),fun_box<F>,fun_ptr<F>>;
+};
+
+template<typename F>
+struct fun_handle<shared_fun<F>>{using type=fun_ptr<F>;};
+
+template<typename F>
+using fun_handle_t=typename fun_handle<F>::type;
+
+template<typename F,typename Cursor>
+struct deref_fun
+{
+  constexpr deref_fun(){}
+  constexpr deref_fun(F& f,Cursor p):f{f},p{std::move(p)}{}
+    
+  constexpr decltype(auto) operator*(){return f.get()(*p);}
+  constexpr decltype(auto) operator*()const{return f.get()(*p);}
+    
+  [[no_unique_address]] fun_handle_t<F> f;
+  Cursor                                p;
+};
+    
+/* block_transform(f,rgr) computes transform(f,rgr) a block at a time into a
+ * stack buffer, a loop compilers reliably vectorize, for rgr a block source
+ * (a block ranger or all() over a contiguous range of arithmetic values)
+ * and f arithmetic-valued. Results are computed eagerly, once per element,
+ * including those of a block past the point where the consumer stops, and
+ * are pushed as value_cursors. transform(f,rgr) takes this path by itself
+ * only if rgr is already a block ranger (e.g. from as_block_ranger) or, with
+ * TRANSRANGERS_SIMD, if f accepts simd<T>.
+ */
+
+template<typename F,typename T>
+constexpr bool is_block_invocable()
+{
+  if constexpr(std::is_void_v<T>)return false;
+  else if constexpr(is_simd_transform<F,T>())return true;
+  else if constexpr(!std::is_invocable_v<F&,const T&>)return false;
+  else return std::is_arithmetic_v<std::invoke_result_t<F&,const T&>>;
+}
+
+template<typename F,typename Ranger>
+constexpr bool is_block_transform()
+{
+  using value_type=block_value_t<Ranger>;
+
+  if constexpr(!is_block_invocable<F,value_type>())return false;
+  else{
+    return is_block_ranger_v<Ranger>||is_simd_transform<F,value_type>();
+  }
+}
+
+template<typename F,typename Ranger>
+struct block_transform_fun
+{
+  using kind=transform_tag;
+  using args=std::tuple<F>;
+  using sources=std::tuple<Ranger>;
+  using value_type=block_value_t<Ranger>;
+  using result_type=block_result_t<F,value_type>;
+
+  template<typename BlockDst>
+  constexpr bool operator()(BlockDst&& bdst)
+  {
+    return rgr.blocks([&](const value_type* p,std::size_t n){
+      result_type buf[block_size];
+      transform_block(f,p,buf,n);
+      return bdst(static_cast<const result_type*>(buf),n);
+    });
+  }
+
+  F      f;
+  Ranger rgr;
+};
+
+template<typename F,typename Ranger>
+constexpr auto block_transform(F f,Ranger rgr)
+{
+  static_assert(
+    is_block_invocable<F,block_value_t<Ranger>>(),
+    "block_transform requires a block source and an arithmetic-valued "
+    "function");
+  using source=decltype(as_block_ranger(rgr));
+  using result_type=block_result_t<F,block_value_t<Ranger>>;
+
+  return block_ranger<result_type>(
+    block_transform_fun<F,source>{f,as_block_ranger(rgr)});
+}
+
+template<typename F,typename Ranger>
+struct transform_fun
+{
+  using kind=transform_tag;
+  using args=std::tuple<F>;
+  using sources=std::tuple<Ranger>;
+  using cursor=deref_fun<F,typename Ranger::cursor>;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    return rgr([&](auto p){return dst(cursor(f,p));});
+  }
+
+  F      f;
+  Ranger rgr;
+};
+    
+template<typename F,typename Ranger>
+constexpr auto transform(F f,Ranger rgr)
+{
+  if constexpr(is_block_transform<F,Ranger>()){
+    return block_transform(f,rgr);
+  }
+  else if constexpr(std::is_same_v<fun_handle_t<F>,fun_ptr<F>>){
+    return transform(shared_fun<F>{std::make_shared<F>(f)},rgr);
+  }
+  else{
+    using cursor=deref_fun<F,typename Ranger::cursor>;
+    
+    return ranger<cursor>(transform_fun<F,Ranger>{f,rgr});
+  }
+}
+
+/* transform_stateful(f,rgr) calls f exactly once per element and in order,
+ * as elements are pushed rather than when (and each time) cursors are
+ * dereferenced, so f can keep state such as counters or running checksums.
+ * The state lives in the ranger, each copy of which has its own. Cursors
+ * hold a copy of the result. scan(op,init,rgr) is built on it and pushes
+ * the running accumulations op(...op(op(init,x0),x1)...,xi).
+ */
+
+template<typename F,typename Ranger>
+struct transform_stateful_fun
 {
-  using cursor=Cursor;
+  using kind=transform_stateful_tag;
+  using args=std::tuple<F>;
+  using sources=std::tuple<Ranger>;
+  using value_type=std::remove_cvref_t<std::invoke_result_t<
+    F&,decltype(*std::declval<typename Ranger::cursor&>())>>;
+  using cursor=value_cursor<value_type>;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    return rgr([&](auto p){return dst(cursor{f(*p)});});
+  }
+
+  F      f;
+  Ranger rgr;
 };
-    
-template<typename Cursor,typename F>
-auto ranger(F f)
+
+template<typename F,typename Ranger>
+constexpr auto transform_stateful(F f,Ranger rgr)
 {
-  return ranger_class<Cursor,F>{f};
+  using cursor=typename transform_stateful_fun<F,Ranger>::cursor;
+
+  return ranger<cursor>(transform_stateful_fun<F,Ranger>{f,rgr});
 }
-    
-template<typename Range>
-auto all(Range&& rng)
+
+template<typename Op,typename T>
+struct scan_fun
 {
-  using std::begin;
-  using std::end;
-  using cursor=decltype(begin(rng));
-  
-  return ranger<cursor>([first=begin(rng),last=end(rng)](auto dst)mutable{
-    while(first!=last)if(!dst(first++))return false;
-    return true;
-  });
-}
-      
-template<typename Pred,typename Ranger>
-auto filter(Pred pred,Ranger rgr)
+  template<typename U>
+  constexpr const T& operator()(U&& x)
+  {
+    return acc=op(std::move(acc),TRANSRANGERS_FWD(x));
+  }
+
+  Op op;
+  T  acc;
+};
+
+template<typename Op,typename T,typename Ranger>
+constexpr auto scan(Op op,T init,Ranger rgr)
 {
-  using cursor=typename Ranger::cursor;
-    
-  return ranger<cursor>([=](auto dst)mutable{
-    return rgr([&](auto p){
-      return pred(*p)?dst(p):true;
-    });
-  });
+  return transform_stateful(scan_fun<Op,T>{op,init},rgr);
 }
 
-template<typename F,typename Cursor>
-struct deref_fun
+template<typename Ranger>
+struct take_fun
 {
-  deref_fun(){}
-  deref_fun(F& f,Cursor p):pf{&f},p{std::move(p)}{}
-    
-  decltype(auto) operator*(){return (*pf)(*p);} 
-    
-  F*     pf;
-  Cursor p;
+  using kind=take_tag;
+  using args=std::tuple<int>;
+  using sources=std::tuple<Ranger>;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    if(left)return rgr([&](auto p){
+      --left;
+      return dst(p)&&(left!=0);
+    })||(left==0);
+    else return true;
+  }
+
+  int    n;
+  Ranger rgr;
+  int    left=n;
 };
-    
-template<typename F,typename Ranger>
-auto transform(F f,Ranger rgr)
-{
-  using cursor=deref_fun<F,typename Ranger::cursor>;
-    
-  return ranger<cursor>([=](auto dst)mutable{
-    return rgr([&](auto p){return dst(cursor(f,p));});
-  });
-}
 
 template<typename Ranger>
-auto take(int n,Ranger rgr)
+constexpr auto take(int n,Ranger rgr)
 {
   using cursor=typename Ranger::cursor;
     
-  return ranger<cursor>([=](auto dst)mutable{
-    if(n)return rgr([&](auto p){
-      --n;
-      return dst(p)&&(n!=0);
-    })||(n==0);
-    else return true;
-  });
+  return ranger<cursor>(take_fun<Ranger>{n,rgr});
 }
 
-auto concat()
+constexpr auto concat()
 {
   return [](auto&&){return true;};
 }
 
+template<typename Ranger,typename Next>
+struct concat_fun
+{
+  using kind=concat_tag;
+  using args=std::tuple<>;
+  using sources=std::tuple<Ranger,Next>;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    if(!cont){
+      if(!(cont=rgr(dst)))return false;
+    }
+    return next(dst);
+  }
+
+  Ranger rgr;
+  Next   next;
+  bool   cont=false;
+};
+
 template<typename Ranger,typename... Rangers>
-auto concat(Ranger rgr,Rangers... rgrs)
+constexpr auto concat(Ranger rgr,Rangers... rgrs)
 {
   using cursor=typename Ranger::cursor;
+  using next_type=decltype(concat(rgrs...));
     
-  return ranger<cursor>(
-    [=,cont=false,next=concat(rgrs...)](auto dst)mutable{
-      if(!cont){
-        if(!(cont=rgr(dst)))return false;
-      }
-      return next(dst);
-    }
-  );
+  return ranger<cursor>(concat_fun<Ranger,next_type>{rgr,concat(rgrs...)});
 }
     
-template<typename Ranger>
-auto unique(Ranger rgr)
+/* unique_by(key_fn,rgr) keeps the key of the last element pushed and skips
+ * elements with an equal key, so key_fn and the upstream dereference are
+ * evaluated once per element. unique(rgr) compares cursors' values: when
+ * these are references, the last cursor is kept instead, and when they're
+ * computed (as for transform), the last value is. block_unique(rgr) over a
+ * block ranger compares each block with itself shifted by one element
+ * through unique_block, a vector at a time with simd, and passes on the
+ * survivors compacted: this costs an extra pass over a buffer but no
+ * branches on the outcome, which pays off with short runs and consumers
+ * that branch themselves. unique uses it with TRANSRANGERS_SIMD over block
+ * rangers (e.g. after an arithmetic transform); for sorted arrays, use
+ * block_unique(as_block_ranger(all(rng))).
+ */
+
+template<typename KeyFn,typename Ranger>
+struct unique_by_fun
+{
+  using kind=unique_by_tag;
+  using args=std::tuple<KeyFn>;
+  using sources=std::tuple<Ranger>;
+  using cursor=typename Ranger::cursor;
+  using key_type=std::remove_cvref_t<
+    std::invoke_result_t<KeyFn&,decltype(*std::declval<cursor&>())>>;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    if(!okey){
+      bool cont=false;
+      if(rgr([&](auto q){
+        okey.emplace(key_fn(*q));
+        cont=dst(q);
+        return false;
+      }))return true;
+      if(!cont)return false;
+    }
+    return rgr([&](auto q){
+      decltype(auto) key=key_fn(*q);
+      if(*okey==key)return true;
+      else{
+        *okey=TRANSRANGERS_FWD(key);
+        return dst(q);
+      }
+    });
+  }
+
+  KeyFn                   key_fn;
+  Ranger                  rgr;
+  std::optional<key_type> okey={};
+};
+
+template<typename KeyFn,typename Ranger>
+constexpr auto unique_by(KeyFn key_fn,Ranger rgr)
 {
   using cursor=typename Ranger::cursor;
     
-  return ranger<cursor>([=,start=true,p=cursor{}](auto dst)mutable{
-    if(start){
-      start=false;
+  return ranger<cursor>(unique_by_fun<KeyFn,Ranger>{key_fn,rgr});
+}
+
+template<typename Ranger>
+struct unique_fun
+{
+  using kind=unique_tag;
+  using args=std::tuple<>;
+  using sources=std::tuple<Ranger>;
+  using cursor=typename Ranger::cursor;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    if(!op){
       bool cont=false;
       if(rgr([&](auto q){
-        p=q;
+        op.emplace(q);
         cont=dst(q);
         return false;
       }))return true;
       if(!cont)return false;
     }
     return rgr([&](auto q){
-      if(*p==*q){p=q;return true;}
+      if(**op==*q){*op=q;return true;}
       else{
-        p=q;
+        *op=q;
         return dst(q);
       }
     });
-  });
+  }
+
+  Ranger                rgr;
+  std::optional<cursor> op={};
+};
+
+template<typename Ranger>
+struct block_unique_fun
+{
+  using kind=unique_tag;
+  using args=std::tuple<>;
+  using sources=std::tuple<Ranger>;
+  using value_type=block_value_t<Ranger>;
+
+  template<typename BlockDst>
+  constexpr bool operator()(BlockDst&& bdst)
+  {
+    return rgr.blocks([&](const value_type* p,std::size_t n){
+      value_type buf[block_size];
+      std::size_t m;
+      if(op)m=unique_block(*op,p,buf,n);
+      else{
+        buf[0]=p[0];
+        m=1+unique_block(p[0],p+1,buf+1,n-1);
+      }
+      op=p[n-1];
+      return m?bdst(static_cast<const value_type*>(buf),m):true;
+    });
+  }
+
+  Ranger                    rgr;
+  std::optional<value_type> op={};
+};
+
+template<typename Ranger>
+constexpr auto block_unique(Ranger rgr)
+{
+  using value_type=block_value_t<Ranger>;
+
+  return block_ranger<value_type>(block_unique_fun<Ranger>{rgr});
+}
+
+template<typename Ranger>
+constexpr bool is_block_unique()
+{
+#if defined(TRANSRANGERS_SIMD)
+  if constexpr(!is_block_ranger_v<Ranger>)return false;
+  else return is_simd_vectorizable<block_value_t<Ranger>>;
+#else
+  return false;
+#endif
+}
+
+template<typename Ranger>
+constexpr auto unique(Ranger rgr)
+{
+  using cursor=typename Ranger::cursor;
+
+  if constexpr(is_block_unique<Ranger>()){
+    return block_unique(rgr);
+  }
+  else if constexpr(!std::is_reference_v<decltype(*std::declval<cursor&>())>){
+    return unique_by([](auto x){return x;},rgr);
+  }
+  else{
+    return ranger<cursor>(unique_fun<Ranger>{rgr});
+  }
 }
 
 template<typename Ranger>
-auto join(Ranger rgr)
+struct join_fun
 {
+  using kind=join_tag;
+  using args=std::tuple<>;
+  using sources=std::tuple<Ranger>;
   using cursor=typename Ranger::cursor;
   using subranger=std::remove_cvref_t<decltype(*std::declval<cursor>())>; 
-  using subranger_cursor=typename subranger::cursor;
+
+  template<typename Dst>
+  constexpr bool operator()(Dst&& dst)
+  {
+    if(osrgr){
+      if(!(*osrgr)(dst))return false;
+    }
+    return(rgr([&](auto p){
+      subranger srgr=*p;
+      auto      cont=srgr(dst);
+      if(!cont)osrgr.emplace(std::move(srgr));
+      return cont;
+    }));
+  }
+
+  Ranger                   rgr;
+  std::optional<subranger> osrgr={};
+};
+
+template<typename Ranger>
+constexpr auto join(Ranger rgr)
+{
+  using subranger_cursor=typename join_fun<Ranger>::subranger::cursor;
     
-  return ranger<subranger_cursor>(
-    [=,osrgr=std::optional<subranger>{}](auto dst)mutable{
-      if(osrgr){
-        if(!(*osrgr)(dst))return false;
-      }
-      return(rgr([&](auto p){
-        auto cont=(*p)(dst);
-        if(!cont)osrgr.emplace(*p);
-        return cont;
-      }));
-  });    
+  return ranger<subranger_cursor>(join_fun<Ranger>{rgr});
 }
 
 template<typename Ranger>
-auto ranger_join(Ranger rgr)
+constexpr auto ranger_join(Ranger rgr)
 {
   auto all_adaptor=[](auto&& srng){
     return all(TRANSRANGERS_FWD(srng));
@@ -173,7 +1567,483 @@ auto ranger_join(Ranger rgr)
   return join(transform(all_adaptor,rgr));
 }
 
+/* optimize(rgr) statically rewrites a pipeline based on its stages:
+ *   - Adjacent filters are merged into one predicate and adjacent transforms
+ *     into one function, so a chain of block transforms runs as one kernel
+ *     and cursors are dereferenced once per chain.
+ *   - take is pushed down through transforms to random-access all() sources,
+ *     which get trimmed instead of counting elements; this keeps block
+ *     transforms from computing past the last element taken.
+ * Transform results never dereferenced need no rewrite, since non-block
+ * transform is computed lazily on dereference. Opaque stages are left as
+ * they are, and concat components keep their cursor type. optimize is meant
+ * for pipelines not yet run, as stage state (take's count excepted) is not
+ * carried over.
+ */
+
+template<typename Pred1,typename Pred2>
+struct both_fun
+{
+  template<typename T>
+  constexpr auto operator()(T&& x)->
+    decltype(std::declval<Pred1&>()(x)&&std::declval<Pred2&>()(x))
+  {
+    return pred1(x)&&pred2(x);
+  }
+
+  Pred1 pred1;
+  Pred2 pred2;
+};
+
+template<typename F,typename G>
+struct compose_fun
+{
+  template<typename T>
+  constexpr auto operator()(T&& x)->
+    decltype(std::declval<F&>()(std::declval<G&>()(TRANSRANGERS_FWD(x))))
+  {
+    return f(g(TRANSRANGERS_FWD(x)));
+  }
+
+  F f;
+  G g;
+};
+
+template<typename Pred,typename Ranger>
+constexpr auto optimized_filter(Pred pred,Ranger rgr)
+{
+  if constexpr(
+    std::is_same_v<stage_kind_t<Ranger>,filter_tag>&&
+    !is_branchless_filter<Ranger>()){
+    auto& s=stage_of(rgr);
+
+    return optimized_filter(both_fun<decltype(s.pred),Pred>{s.pred,pred},s.rgr);
+  }
+  else return filter(pred,rgr);
+}
+
+template<typename F,typename Ranger>
+constexpr auto optimized_transform(F f,Ranger rgr)
+{
+  if constexpr(std::is_same_v<stage_kind_t<Ranger>,transform_tag>){
+    auto& s=stage_of(rgr);
+
+    return optimized_transform(compose_fun<F,decltype(s.f)>{f,s.f},s.rgr);
+  }
+  else return transform(f,rgr);
+}
+
+template<typename Ranger>
+constexpr auto pushed_take(int n,Ranger rgr)
+{
+  using kind=stage_kind_t<Ranger>;
+
+  if constexpr(std::is_same_v<kind,transform_tag>){
+    auto& s=stage_of(rgr);
+
+    return transform(s.f,pushed_take(n,s.rgr));
+  }
+  else if constexpr(std::is_same_v<kind,all_tag>){
+    if constexpr(std::random_access_iterator<decltype(stage_of(rgr).first)>){
+      auto& s=stage_of(rgr);
+      auto  size=s.last-s.first;
+
+      if(n>=0&&n<size)s.last=s.first+n;
+      return rgr;
+    }
+    else return take(n,rgr);
+  }
+  else return take(n,rgr);
+}
+
+template<typename Ranger>
+constexpr auto optimize(Ranger rgr)
+{
+  using kind=stage_kind_t<Ranger>;
+
+  if constexpr(std::is_same_v<kind,filter_tag>){
+    auto& s=stage_of(rgr);
+
+    if constexpr(is_branchless_filter<Ranger>()){
+      return branchless_filter(s.pred,optimize(s.rgr));
+    }
+    else return optimized_filter(s.pred,optimize(s.rgr));
+  }
+  else if constexpr(std::is_same_v<kind,transform_tag>){
+    auto& s=stage_of(rgr);
+
+    return optimized_transform(s.f,optimize(s.rgr));
+  }
+  else if constexpr(std::is_same_v<kind,transform_stateful_tag>){
+    auto& s=stage_of(rgr);
+
+    return transform_stateful(s.f,optimize(s.rgr));
+  }
+  else if constexpr(std::is_same_v<kind,take_tag>){
+    auto& s=stage_of(rgr);
+
+    return pushed_take(s.left,optimize(s.rgr));
+  }
+  else if constexpr(std::is_same_v<kind,concat_tag>){
+    /* components must keep sharing the same cursor type */
+    auto  same_cursor_optimize=[](auto r){
+      using ranger_type=decltype(r);
+
+      if constexpr(!is_ranger_v<ranger_type>)return r;
+      else if constexpr(!std::is_same_v<
+        typename decltype(optimize(r))::cursor,
+        typename ranger_type::cursor>)return r;
+      else return optimize(r);
+    };
+    auto& s=stage_of(rgr);
+    auto  first=same_cursor_optimize(s.rgr);
+    auto  next=same_cursor_optimize(s.next);
+    using cursor=typename decltype(first)::cursor;
+
+    return ranger<cursor>(
+      concat_fun<decltype(first),decltype(next)>{first,next,s.cont});
+  }
+  else if constexpr(std::is_same_v<kind,unique_tag>){
+    return unique(optimize(stage_of(rgr).rgr));
+  }
+  else if constexpr(std::is_same_v<kind,unique_by_tag>){
+    auto& s=stage_of(rgr);
+
+    return unique_by(s.key_fn,optimize(s.rgr));
+  }
+  else if constexpr(std::is_same_v<kind,join_tag>){
+    return join(optimize(stage_of(rgr).rgr));
+  }
+  else return rgr;
+}
+
+/* rebind(rgr,rngs...) makes a pipeline run again over new data without
+ * being rebuilt: its plain all() sources, in the order concat visits them,
+ * are repointed to rngs, one range per source, and stage state (take's
+ * remaining count, concat's position, unique's last element, join's pending
+ * subranger, leftovers of block rangers and branchless_filter) is reset.
+ * The state of transform_stateful functions is not. Pipelines with opaque
+ * stages or other sources (e.g. narrowed by filter pushdown) can't be
+ * rebound.
+ */
+
+template<typename T,typename F>
+constexpr void reset_pending(block_ranger_class<T,F>& rgr)
+{
+  rgr.pfirst=rgr.plast=0;
+}
+
+template<typename Cursor,typename Pred,typename Ranger>
+constexpr void reset_pending(
+  ranger_class<Cursor,branchless_filter_fun<Pred,Ranger>>& rgr)
+{
+  rgr.m=rgr.pfirst=0;
+}
+
+template<typename Ranger>
+constexpr void reset_pending(Ranger&){}
+
+template<typename Ranger>
+constexpr std::size_t source_count()
+{
+  using kind=stage_kind_t<Ranger>;
+  using stage=stage_t<Ranger>;
+
+  if constexpr(std::is_same_v<kind,concat_tag>){
+    using next=decltype(std::declval<stage&>().next);
+
+    if constexpr(is_ranger_v<next>){
+      return
+        source_count<decltype(std::declval<stage&>().rgr)>()+
+        source_count<next>();
+    }
+    else return source_count<decltype(std::declval<stage&>().rgr)>();
+  }
+  else if constexpr(
+    std::is_same_v<kind,all_tag>||std::is_same_v<kind,opaque_tag>){
+    return 1;
+  }
+  else return source_count<decltype(std::declval<stage&>().rgr)>();
+}
+
+/* rebinds the sources of rgr to rngs[I], rngs[I+1]... */
+
+template<std::size_t I,typename Ranger,typename Ranges>
+constexpr void rebind_sources(Ranger& rgr,Ranges& rngs)
+{
+  using kind=stage_kind_t<Ranger>;
+  using stage=stage_t<Ranger>;
+  auto& s=stage_of(rgr);
+
+  reset_pending(rgr);
+  if constexpr(std::is_same_v<kind,all_tag>){
+    static_assert(
+      std::is_same_v<stage,all_fun<decltype(s.first)>>||
+      std::is_same_v<stage,all_block_fun<decltype(s.first)>>,
+      "only plain all() sources can be rebound");
+    using std::begin;
+    using std::end;
+    auto& rng=std::get<I>(rngs);
+
+    s.first=begin(rng);
+    s.last=end(rng);
+  }
+  else if constexpr(
+    std::is_same_v<kind,filter_tag>||
+    std::is_same_v<kind,transform_tag>||
+    std::is_same_v<kind,transform_stateful_tag>){
+    rebind_sources<I>(s.rgr,rngs);
+  }
+  else if constexpr(std::is_same_v<kind,take_tag>){
+    s.left=s.n;
+    rebind_sources<I>(s.rgr,rngs);
+  }
+  else if constexpr(std::is_same_v<kind,concat_tag>){
+    s.cont=false;
+    rebind_sources<I>(s.rgr,rngs);
+    if constexpr(is_ranger_v<decltype(s.next)>){
+      rebind_sources<I+source_count<decltype(s.rgr)>()>(s.next,rngs);
+    }
+  }
+  else if constexpr(std::is_same_v<kind,unique_tag>){
+    s.op.reset();
+    rebind_sources<I>(s.rgr,rngs);
+  }
+  else if constexpr(std::is_same_v<kind,unique_by_tag>){
+    s.okey.reset();
+    rebind_sources<I>(s.rgr,rngs);
+  }
+  else if constexpr(std::is_same_v<kind,join_tag>){
+    s.osrgr.reset();
+    rebind_sources<I>(s.rgr,rngs);
+  }
+  else{
+    static_assert(!std::is_same_v<kind,kind>,"opaque stages can't be rebound");
+  }
+}
+
+template<typename Ranger,typename... Ranges>
+constexpr Ranger& rebind(Ranger& rgr,Ranges&&... rngs)
+{
+  static_assert(
+    sizeof...(Ranges)==source_count<Ranger>(),
+    "rebind takes one range per source of the pipeline");
+  auto t=std::forward_as_tuple(rngs...);
+
+  rebind_sources<0>(rgr,t);
+  return rgr;
+}
+
+/* tee(sinks...) is a consumer fanning out each cursor to several sinks in
+ * one pass. A sink returning false is not fed again; tee itself returns false
+ * once all sinks have stopped. Rangers take their consumer by reference, so
+ * the per-sink state survives concat/join and resumed runs.
+ */
+
+template<typename... Sinks>
+struct tee_class
+{
+  static_assert(sizeof...(Sinks)>0,"tee requires at least one sink");
+
+  template<typename Cursor>
+  constexpr bool operator()(Cursor p)
+  {
+    return push(p,std::index_sequence_for<Sinks...>{});
+  }
+
+  template<typename Cursor,std::size_t... I>
+  constexpr bool push(Cursor& p,std::index_sequence<I...>)
+  {
+    return (...|(active[I]&&(active[I]=std::get<I>(sinks)(p))));
+  }
+
+  std::tuple<Sinks...> sinks;
+  bool                 active[sizeof...(Sinks)]={((void)sizeof(Sinks),true)...};
+};
+
+template<typename... Sinks>
+constexpr auto tee(Sinks... sinks)
+{
+  return tee_class<Sinks...>{{sinks...}};
+}
+
+/* Search terminals: count_if(pred,rgr) returns the number of elements
+ * satisfying pred, find_if(pred,rgr) a std::optional with the cursor of the
+ * first one, after which rgr can be resumed, and contains_if(pred,rgr)
+ * whether there is any; count(x,rgr), find(x,rgr) and contains(x,rgr) search
+ * for equal_to(x). For the range predicate forms over sources producing
+ * blocks (all() over contiguous arithmetic sequences and block rangers),
+ * values are compared a vector at a time by branch-free match counting
+ * loops the compiler vectorizes under ISA dispatch (not through simd<T>);
+ * predicates are copied into the kernels so that their bounds are loaded
+ * once. Other searches run through the push protocol.
+ */
+
+template<typename Pred>
+struct is_range_predicate:std::false_type{};
+
+template<typename T>
+struct is_range_predicate<between_fun<T>>:std::true_type{};
+
+template<typename T>
+struct is_range_predicate<less_than_fun<T>>:std::true_type{};
+
+template<typename T>
+struct is_range_predicate<equal_to_fun<T>>:std::true_type{};
+
+template<typename Pred,typename Ranger>
+constexpr bool is_block_search()
+{
+  return is_range_predicate<Pred>::value&&
+    !std::is_void_v<block_value_t<Ranger>>;
+}
+
+struct count_block_kernel
+{
+  template<typename Pred,typename T>
+  static TRANSRANGERS_FORCEINLINE
+  std::size_t run(Pred pred,const T* p,std::size_t n)
+  {
+    std::size_t c=0;
+    for(std::size_t i=0;i<n;++i)c+=static_cast<bool>(pred(p[i]));
+    return c;
+  }
+};
+
+template<typename Pred,typename T>
+constexpr std::size_t count_block(const Pred& pred,const T* p,std::size_t n)
+{
+  if(std::is_constant_evaluated()){
+    std::size_t c=0;
+    for(std::size_t i=0;i<n;++i)c+=static_cast<bool>(pred(p[i]));
+    return c;
+  }
+  return count_block_kernel::run(pred,p,n);
+}
+
+/* returns the position of the first match, or n */
+struct find_block_kernel
+{
+  template<typename Pred,typename T>
+  static TRANSRANGERS_FORCEINLINE
+  std::size_t run(Pred pred,const T* p,std::size_t n)
+  {
+    /* branch-free match count over each block, located if positive */
+    for(std::size_t i=0;i<n;i+=block_size){
+      std::size_t m=std::min(block_size,n-i);
+      unsigned    c=0;
+      for(std::size_t j=0;j<m;++j)c+=static_cast<bool>(pred(p[i+j]));
+      if(c)for(std::size_t j=0;;++j)if(pred(p[i+j]))return i+j;
+    }
+    return n;
+  }
+};
+
+template<typename Pred,typename T>
+constexpr std::size_t find_block(const Pred& pred,const T* p,std::size_t n)
+{
+  if(std::is_constant_evaluated()){
+    std::size_t i=0;
+    while(i<n&&!pred(p[i]))++i;
+    return i;
+  }
+  return find_block_kernel::run(pred,p,n);
+}
+
+template<typename Pred,typename Ranger>
+constexpr std::size_t count_if(Pred pred,Ranger&& rgr)
+{
+  using ranger_type=std::remove_cvref_t<Ranger>;
+
+  std::size_t c=0;
+  if constexpr(is_block_search<Pred,ranger_type>()){
+    if constexpr(is_block_ranger_v<ranger_type>){
+      rgr.blocks([&](const auto* p,std::size_t n){
+        c+=count_block(pred,p,n);
+        return true;
+      });
+    }
+    else{
+      auto& s=stage_of(rgr);
+      auto  p=std::to_address(s.first);
+      auto  n=static_cast<std::size_t>(s.last-s.first);
+      c=std::is_constant_evaluated()?
+        count_block(pred,p,n):dispatch<count_block_kernel>(pred,p,n);
+      s.first=s.last;
+    }
+  }
+  else rgr([&](auto p){
+    c+=static_cast<bool>(pred(*p));
+    return true;
+  });
+  return c;
+}
+
+template<typename T,typename Ranger>
+constexpr std::size_t count(const T& x,Ranger&& rgr)
+{
+  return count_if(equal_to(x),TRANSRANGERS_FWD(rgr));
+}
+
+template<typename Pred,typename Ranger>
+constexpr auto find_if(Pred pred,Ranger&& rgr)
+{
+  using ranger_type=std::remove_cvref_t<Ranger>;
+  using cursor=typename ranger_type::cursor;
+
+  std::optional<cursor> res;
+  if constexpr(is_block_search<Pred,ranger_type>()){
+    if constexpr(is_block_ranger_v<ranger_type>){
+      rgr.blocks([&](const auto* p,std::size_t n){
+        auto i=find_block(pred,p,n);
+        if(i==n)return true;
+        res.emplace(cursor{p[i]});
+        std::copy(p+i+1,p+n,rgr.pending);
+        rgr.pfirst=0;
+        rgr.plast=n-i-1;
+        return false;
+      });
+    }
+    else{
+      auto& s=stage_of(rgr);
+      auto  p=std::to_address(s.first);
+      auto  n=static_cast<std::size_t>(s.last-s.first),
+            i=std::is_constant_evaluated()?
+              find_block(pred,p,n):dispatch<find_block_kernel>(pred,p,n);
+      if(i<n)res.emplace(s.first+i++);
+      s.first+=i;
+    }
+  }
+  else rgr([&](auto p){
+    if(!pred(*p))return true;
+    res.emplace(p);
+    return false;
+  });
+  return res;
+}
+
+template<typename T,typename Ranger>
+constexpr auto find(const T& x,Ranger&& rgr)
+{
+  return find_if(equal_to(x),TRANSRANGERS_FWD(rgr));
+}
+
+template<typename Pred,typename Ranger>
+constexpr bool contains_if(Pred pred,Ranger&& rgr)
+{
+  return find_if(pred,TRANSRANGERS_FWD(rgr)).has_value();
+}
+
+template<typename T,typename Ranger>
+constexpr bool contains(const T& x,Ranger&& rgr)
+{
+  return contains_if(equal_to(x),TRANSRANGERS_FWD(rgr));
+}
+
 } /* namespace transrangers */
 
 #undef TRANSRANGERS_FWD
+#undef TRANSRANGERS_FORCEINLINE
+#undef TRANSRANGERS_TARGET_AVX2
+#undef TRANSRANGERS_TARGET_AVX512
 #endif
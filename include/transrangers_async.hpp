@@ -0,0 +1,227 @@
+/* Transrangers: interleaved and asynchronous execution.
+ *
+ * Copyright 2021 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * See https://github.com/joaquintides/transrangers for project home page.
+ */
+
+#ifndef JOAQUINTIDES_TRANSRANGERS_ASYNC_HPP
+#define JOAQUINTIDES_TRANSRANGERS_ASYNC_HPP
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <span>
+#include <utility>
+#include "transrangers.hpp"
+
+namespace transrangers{
+
+/* run_for(rgr,dst,budget) feeds rgr to dst for at most budget elements or,
+ * if budget is a duration, for about that long, the clock being read every
+ * check_every elements. It returns a run_handle whose resume(budget)
+ * continues the run where it left off, which the bool protocol allows for
+ * any ranger, so long scans can be interleaved with other work on the same
+ * thread. done() tells whether the run is over, either because rgr is
+ * exhausted (exhausted is then true) or because dst returned false.
+ */
+
+template<typename Ranger,typename Dst>
+struct run_handle
+{
+  using clock=std::chrono::steady_clock;
+
+  bool done()const{return finished;}
+
+  run_handle& resume(std::size_t n)
+  {
+    return step(n,clock::time_point::max());
+  }
+
+  template<typename Rep,typename Period>
+  run_handle& resume(std::chrono::duration<Rep,Period> t)
+  {
+    return step(
+      std::size_t(-1),
+      clock::now()+std::chrono::duration_cast<clock::duration>(t));
+  }
+
+  run_handle& step(std::size_t n,clock::time_point deadline)
+  {
+    if(finished||n==0)return *this;
+
+    /* a single countdown per element, to the next clock read or budget end */
+    bool        timed=deadline!=clock::time_point::max(),
+                paused=false;
+    std::size_t chunk=timed?std::min(n,check_every):n,
+                k=chunk;
+    exhausted=rgr([&](auto p){
+      if(!dst(p))return false;
+      if(--k==0){
+        n-=chunk;
+        if(n==0||(timed&&clock::now()>=deadline))paused=true;
+        else k=chunk=std::min(n,check_every);
+      }
+      return !paused;
+    });
+    finished=exhausted||!paused;
+    return *this;
+  }
+
+  Ranger      rgr;
+  Dst         dst;
+  std::size_t check_every=256;
+  bool        finished=false,exhausted=false;
+};
+
+template<typename Ranger,typename Dst,typename Budget>
+auto run_for(
+  Ranger rgr,Dst dst,Budget budget,std::size_t check_every=256)
+{
+  run_handle<Ranger,Dst> h{std::move(rgr),std::move(dst),check_every};
+  h.resume(budget);
+  return h;
+}
+
+/* async_task<T> is a lazily started coroutine returning T. It can be
+ * co_awaited from another coroutine, or started with start() from plain
+ * code (e.g. an event loop), which then checks done() and get().
+ */
+
+template<typename T>
+struct async_task
+{
+  struct promise_type;
+  using handle=std::coroutine_handle<promise_type>;
+
+  struct final_awaiter
+  {
+    bool await_ready()noexcept{return false;}
+    void await_resume()noexcept{}
+
+    std::coroutine_handle<> await_suspend(handle h)noexcept
+    {
+      auto c=h.promise().continuation;
+      return c?c:std::noop_coroutine();
+    }
+  };
+
+  struct promise_type
+  {
+    async_task get_return_object(){return async_task{handle::from_promise(*this)};}
+    std::suspend_always initial_suspend()noexcept{return {};}
+    final_awaiter final_suspend()noexcept{return {};}
+    void return_value(T x){value=std::move(x);}
+    void unhandled_exception(){eptr=std::current_exception();}
+
+    T                       value={};
+    std::exception_ptr      eptr;
+    std::coroutine_handle<> continuation;
+  };
+
+  async_task(handle h):h{h}{}
+  async_task(async_task&& x):h{std::exchange(x.h,{})}{}
+  async_task& operator=(async_task&&)=delete;
+  ~async_task(){if(h)h.destroy();}
+
+  bool await_ready()const noexcept{return false;}
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> c)
+  {
+    h.promise().continuation=c;
+    return h;
+  }
+
+  T await_resume(){return get();}
+
+  void start(){h.resume();}
+  bool done()const{return h.done();}
+
+  T get()
+  {
+    if(h.promise().eptr)std::rethrow_exception(h.promise().eptr);
+    return std::move(h.promise().value);
+  }
+
+  handle h;
+};
+
+/* Async pipelines. An async source is an object with a value_type and a
+ * next() member returning an awaitable that resolves to a std::span of
+ * value_type with the next block of data, empty at the end; the block must
+ * stay valid until next() is called again. async_run(src,make_pipeline,dst)
+ * builds make_pipeline(rgr) once over a ranger rgr reading the blocks
+ * through an async_channel, and pushes the pipeline into dst, co_awaiting
+ * the next block whenever the current one runs out: the channel ranger then
+ * returns false with its channel flagged as starved, which the synchronous
+ * stages treat as a regular stop, keeping their state (take's count,
+ * unique's last element etc.) for when the pipeline is resumed. The
+ * resulting async_task<bool> tells whether the pipeline was exhausted, as
+ * opposed to stopped by dst.
+ */
+
+template<typename T>
+struct async_channel
+{
+  const T* first=nullptr;
+  const T* last=nullptr;
+  bool     eof=false,starved=false;
+};
+
+template<typename T>
+struct channel_all_fun
+{
+  template<typename Dst>
+  bool operator()(Dst&& dst)
+  {
+    auto& c=*pc;
+    while(c.first!=c.last)if(!dst(c.first++))return false;
+    if(c.eof)return true;
+    c.starved=true;
+    return false;
+  }
+
+  async_channel<T>* pc;
+};
+
+template<typename T>
+auto channel_all(async_channel<T>& c)
+{
+  return ranger<const T*>(channel_all_fun<T>{&c});
+}
+
+template<typename Source,typename MakePipeline,typename Dst>
+async_task<bool> async_run(Source& src,MakePipeline make_pipeline,Dst dst)
+{
+  using value_type=typename Source::value_type;
+
+  async_channel<value_type> chan;
+  auto                      rgr=make_pipeline(channel_all(chan));
+
+  for(;;){
+    if(chan.first==chan.last&&!chan.eof){
+      std::span<const value_type> block=co_await src.next();
+      if(block.empty())chan.eof=true;
+      else{
+        chan.first=block.data();
+        chan.last=block.data()+block.size();
+      }
+    }
+    chan.starved=false;
+    if(rgr(dst))co_return true;
+    if(!chan.starved)co_return false;
+  }
+}
+
+} /* namespace transrangers */
+
+#endif
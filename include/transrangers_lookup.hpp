@@ -0,0 +1,401 @@
+/* Transrangers: batched lookup stages.
+ *
+ * Copyright 2021 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * See https://github.com/joaquintides/transrangers for project home page.
+ */
+
+#ifndef JOAQUINTIDES_TRANSRANGERS_LOOKUP_HPP
+#define JOAQUINTIDES_TRANSRANGERS_LOOKUP_HPP
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "transrangers.hpp"
+
+#if defined(__GNUC__)||defined(__clang__)
+#define TRANSRANGERS_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define TRANSRANGERS_PREFETCH(p) ((void)(p))
+#endif
+
+namespace transrangers{
+
+/* Lookup stages pull lookup_batch_size elements at a time from upstream,
+ * resolve all their lookups together so that cache misses of different
+ * elements overlap, and then push the results in order; they are buffering
+ * stages (see the block protocol in transrangers.hpp). Each stage provides
+ * a resolver, called as resolver(batch,res,m) to fill res for the m
+ * cursors in batch: it returns the number of results, having moved the
+ * cursors of elements without one out of the first positions.
+ */
+
+constexpr std::size_t lookup_batch_size=16;
+
+template<typename Cursor,typename Result>
+struct lookup_cursor
+{
+  auto operator*()const
+  {
+    return std::pair<decltype(*p),Result>{*p,res};
+  }
+
+  Cursor p;
+  Result res;
+};
+
+template<typename Resolver,typename Ranger>
+struct batch_fun
+{
+  using upstream_cursor=typename Ranger::cursor;
+  using result_type=typename Resolver::result_type;
+  using cursor=lookup_cursor<upstream_cursor,result_type>;
+
+  template<typename Dst>
+  bool operator()(Dst&& dst)
+  {
+    if(!flush(dst))return false;
+    if(!rgr([&](auto p){
+      batch[m++]=p;
+      if(m<lookup_batch_size)return true;
+      resolve();
+      return flush(dst);
+    }))return false;
+    resolve();
+    return flush(dst);
+  }
+
+  void resolve()
+  {
+    plast=resolver(batch,res,m);
+    pfirst=0;
+    m=0;
+  }
+
+  template<typename Dst>
+  bool flush(Dst& dst)
+  {
+    while(pfirst!=plast){
+      auto i=pfirst++;
+      if(!dst(cursor{batch[i],res[i]}))return false;
+    }
+    return true;
+  }
+
+  Resolver        resolver;
+  Ranger          rgr;
+  upstream_cursor batch[lookup_batch_size]={};
+  result_type     res[lookup_batch_size]={};
+  std::size_t     m=0,pfirst=0,plast=0;
+};
+
+template<typename Resolver,typename Ranger>
+auto batch_ranger(Resolver resolver,Ranger rgr)
+{
+  using cursor=typename batch_fun<Resolver,Ranger>::cursor;
+
+  return ranger<cursor>(batch_fun<Resolver,Ranger>{resolver,rgr});
+}
+
+/* make_eytzinger_index(rgr) sorts the values of rgr into a complete binary
+ * tree laid out in breadth-first (Eytzinger) order, padded with copies of the
+ * maximum value: the first levels, visited by every search, share a few
+ * cache lines, and the two children of a node are adjacent. Searches take
+ * a fixed number of branchless steps. Results are ranks (positions in
+ * sorted order, size() if not found); operator[] maps them back to values.
+ */
+
+template<typename T>
+struct eytzinger_index
+{
+  std::size_t size()const{return n;}
+
+  const T& operator[](std::size_t r)const
+  {
+    auto t=static_cast<std::size_t>(std::countr_zero(r+1)),
+         d=h-1-t;
+    return tree[(std::size_t(1)<<d)+((r+1)>>(t+1))];
+  }
+
+  template<typename Key>
+  std::size_t lower_bound(const Key& x)const
+  {
+    std::size_t r;
+    batch_lower_bound(&x,&r,1);
+    return r;
+  }
+
+  /* searches are run level by level across the batch, so the loads of a
+   * level are independent of each other and their misses overlap.
+   */
+  template<typename Key>
+  void batch_lower_bound(const Key* x,std::size_t* r,std::size_t m)const
+  {
+    std::size_t k[lookup_batch_size];
+    for(std::size_t i=0;i<m;++i)k[i]=1;
+    for(std::size_t l=0;l<h;++l){
+      for(std::size_t i=0;i<m;++i)k[i]=2*k[i]+(tree[k[i]]<x[i]);
+    }
+    for(std::size_t i=0;i<m;++i){
+      auto kk=k[i]>>(std::countr_one(k[i])+1);
+      r[i]=kk?rank(kk):n;
+    }
+  }
+
+  std::size_t rank(std::size_t k)const
+  {
+    auto d=static_cast<std::size_t>(std::bit_width(k))-1;
+    return (2*(k-(std::size_t(1)<<d))+1)*(std::size_t(1)<<(h-1-d))-1;
+  }
+
+  std::vector<T> tree; /* 1-based */
+  std::size_t    n=0,h=0;
+};
+
+template<typename Ranger>
+auto make_eytzinger_index(Ranger rgr)
+{
+  using value_type=std::remove_cvref_t<
+    decltype(*std::declval<typename Ranger::cursor&>())>;
+
+  std::vector<value_type> sorted;
+  rgr([&](auto p){sorted.push_back(*p);return true;});
+  std::sort(sorted.begin(),sorted.end());
+
+  eytzinger_index<value_type> index;
+  index.n=sorted.size();
+  index.h=static_cast<std::size_t>(std::bit_width(index.n));
+  if(index.n){
+    std::size_t m=(std::size_t(1)<<index.h)-1;
+    index.tree.reserve(m+1);
+    index.tree.push_back(sorted.back());
+    for(std::size_t k=1;k<=m;++k){
+      auto r=index.rank(k);
+      index.tree.push_back(r<index.n?sorted[r]:sorted.back());
+    }
+  }
+  return index;
+}
+
+/* lookup(index,key_fn,rgr) pushes, for each element x of rgr, a cursor
+ * dereferencing to std::pair{x,index.lower_bound(key_fn(x))}, with lookups
+ * batched through index.batch_lower_bound. Elements are dereferenced
+ * again when the resulting cursors are. The ranger refers to index, which
+ * must outlive it (temporaries are rejected).
+ */
+
+template<typename Index,typename KeyFn>
+struct lookup_resolver
+{
+  using result_type=std::size_t;
+
+  template<typename Cursor>
+  std::size_t operator()(Cursor* batch,std::size_t* res,std::size_t m)
+  {
+    using key_type=std::remove_cvref_t<
+      std::invoke_result_t<KeyFn&,decltype(*std::declval<Cursor&>())>>;
+
+    key_type keys[lookup_batch_size];
+    for(std::size_t i=0;i<m;++i)keys[i]=key_fn(*batch[i]);
+    pindex->batch_lower_bound(keys,res,m);
+    return m;
+  }
+
+  const Index* pindex;
+  KeyFn        key_fn;
+};
+
+template<typename Index,typename KeyFn,typename Ranger>
+auto lookup(const Index& index,KeyFn key_fn,Ranger rgr)
+{
+  return batch_ranger(lookup_resolver<Index,KeyFn>{&index,key_fn},rgr);
+}
+
+template<typename Index,typename KeyFn,typename Ranger>
+auto lookup(const Index&&,KeyFn,Ranger)=delete;
+
+/* flat_hash_map is an open-addressing hash table with linear probing over
+ * a single array of slots, kept at most half full. Keys and values must be
+ * default constructible. Hash values are scrambled so that identity hashes
+ * (as std::hash is for integers) spread over the table. Besides find(key),
+ * it provides hash(key), prefetch(hash) and find(key,hash) for batched
+ * probing.
+ */
+
+template<
+  typename Key,typename Value,
+  typename Hash=std::hash<Key>,typename Pred=std::equal_to<Key>
+>
+struct flat_hash_map
+{
+  using key_type=Key;
+  using mapped_type=Value;
+  using value_type=std::pair<Key,Value>;
+
+  struct slot
+  {
+    value_type value;
+    bool       full=false;
+  };
+
+  std::size_t size()const{return n;}
+
+  std::size_t hash(const Key& k)const
+  {
+    auto x=static_cast<std::uint64_t>(hf(k))*0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>(x^(x>>32));
+  }
+
+  void prefetch(std::size_t hv)const
+  {
+    if(!slots.empty())TRANSRANGERS_PREFETCH(slots.data()+(hv&mask));
+  }
+
+  const value_type* find(const Key& k)const{return find(k,hash(k));}
+
+  const value_type* find(const Key& k,std::size_t hv)const
+  {
+    if(slots.empty())return nullptr;
+    for(auto i=hv&mask;slots[i].full;i=(i+1)&mask){
+      if(eq(slots[i].value.first,k))return &slots[i].value;
+    }
+    return nullptr;
+  }
+
+  /* does nothing if the key is already present */
+  bool insert(value_type x)
+  {
+    if(2*(n+1)>slots.size())rehash(std::max<std::size_t>(16,2*slots.size()));
+
+    auto i=hash(x.first)&mask;
+    for(;slots[i].full;i=(i+1)&mask){
+      if(eq(slots[i].value.first,x.first))return false;
+    }
+    slots[i].value=std::move(x);
+    slots[i].full=true;
+    ++n;
+    return true;
+  }
+
+  /* capacity must be a power of two */
+  void rehash(std::size_t capacity)
+  {
+    std::vector<slot> old(capacity);
+    old.swap(slots);
+    mask=capacity-1;
+    n=0;
+    for(auto& s:old)if(s.full)insert(std::move(s.value));
+  }
+
+  Hash              hf;
+  Pred              eq;
+  std::vector<slot> slots;
+  std::size_t       mask=0,n=0;
+};
+
+/* probe(table,key_fn,rgr) pushes, for each element x of rgr whose key
+ * key_fn(x) is found in table, a cursor dereferencing to
+ * std::pair{x,pointer to table entry}. Tables providing hash(key),
+ * prefetch(hash) and find(key,hash), as flat_hash_map does, are probed in
+ * batches: all hashes of a batch are computed and their slots prefetched
+ * before the first lookup. Other tables (e.g. std::unordered_map, whose
+ * node chains can't be prefetched) are probed one key at a time through
+ * find(key). The ranger and its cursors refer to table, which must outlive
+ * them (temporaries are rejected).
+ */
+
+template<typename Table,typename Key>
+constexpr bool is_prefetchable_table()
+{
+  return requires(const Table& t,const Key& k){
+    t.prefetch(t.hash(k));
+    t.find(k,t.hash(k));
+  };
+}
+
+template<typename Table,typename KeyFn>
+struct probe_resolver
+{
+  using result_type=const typename Table::value_type*;
+
+  template<typename Cursor>
+  std::size_t operator()(Cursor* batch,result_type* res,std::size_t m)
+  {
+    using key_type=std::remove_cvref_t<
+      std::invoke_result_t<KeyFn&,decltype(*std::declval<Cursor&>())>>;
+
+    key_type    keys[lookup_batch_size];
+    std::size_t hashes[lookup_batch_size],j=0;
+    for(std::size_t i=0;i<m;++i){
+      keys[i]=key_fn(*batch[i]);
+      hashes[i]=ptable->hash(keys[i]);
+      ptable->prefetch(hashes[i]);
+    }
+    for(std::size_t i=0;i<m;++i){
+      if(auto pv=ptable->find(keys[i],hashes[i])){
+        batch[j]=batch[i];
+        res[j++]=pv;
+      }
+    }
+    return j;
+  }
+
+  const Table* ptable;
+  KeyFn        key_fn;
+};
+
+template<typename Table,typename KeyFn,typename Ranger>
+struct probe_fun
+{
+  using result_type=const typename Table::value_type*;
+  using cursor=lookup_cursor<typename Ranger::cursor,result_type>;
+
+  template<typename Dst>
+  bool operator()(Dst&& dst)
+  {
+    return rgr([&](auto p){
+      auto it=ptable->find(key_fn(*p));
+      return it!=ptable->end()?dst(cursor{p,&*it}):true;
+    });
+  }
+
+  const Table* ptable;
+  KeyFn        key_fn;
+  Ranger       rgr;
+};
+
+template<typename Table,typename KeyFn,typename Ranger>
+auto probe(const Table& table,KeyFn key_fn,Ranger rgr)
+{
+  using key_type=std::remove_cvref_t<std::invoke_result_t<
+    KeyFn&,decltype(*std::declval<typename Ranger::cursor&>())>>;
+
+  if constexpr(is_prefetchable_table<Table,key_type>()){
+    return batch_ranger(probe_resolver<Table,KeyFn>{&table,key_fn},rgr);
+  }
+  else{
+    using cursor=typename probe_fun<Table,KeyFn,Ranger>::cursor;
+
+    return ranger<cursor>(probe_fun<Table,KeyFn,Ranger>{&table,key_fn,rgr});
+  }
+}
+
+template<typename Table,typename KeyFn,typename Ranger>
+auto probe(const Table&&,KeyFn,Ranger)=delete;
+
+} /* namespace transrangers */
+
+#undef TRANSRANGERS_PREFETCH
+#endif
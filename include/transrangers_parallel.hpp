@@ -0,0 +1,830 @@
+/* Transrangers: parallel execution utilities.
+ *
+ * Copyright 2021 Joaquin M Lopez Munoz.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * See https://github.com/joaquintides/transrangers for project home page.
+ */
+
+#ifndef JOAQUINTIDES_TRANSRANGERS_PARALLEL_HPP
+#define JOAQUINTIDES_TRANSRANGERS_PARALLEL_HPP
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <version>
+#include "transrangers.hpp"
+
+#if defined(TRANSRANGERS_TBB)
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#endif
+
+#if defined(TRANSRANGERS_SENDERS)
+#if __has_include(<stdexec/execution.hpp>)
+#include <stdexec/execution.hpp>
+#define TRANSRANGERS_EXECUTION stdexec
+#else
+#include <execution>
+#define TRANSRANGERS_EXECUTION std::execution
+#endif
+#endif
+
+namespace transrangers{
+
+/* cached, as hardware_concurrency() may read system files on each call */
+
+inline std::size_t concurrency()
+{
+  static const std::size_t n=std::max(1u,std::thread::hardware_concurrency());
+  return n;
+}
+
+/* Runs f(0),...,f(n-1) on up to concurrency() threads, the calling thread
+ * included. Indices are handed out dynamically so uneven tasks balance out.
+ */
+
+template<typename F>
+void parallel_for(std::size_t n,F f)
+{
+  std::size_t              nthreads=std::min(n,concurrency());
+  std::atomic<std::size_t> next=0;
+  auto                     work=[&]{
+    for(std::size_t i;(i=next++)<n;)f(i);
+  };
+
+  std::vector<std::thread> threads;
+  for(std::size_t i=1;i<nthreads;++i)threads.emplace_back(work);
+  work();
+  for(auto& t:threads)t.join();
+}
+
+/* Parallel pipelines consist of filter and transform stages over all()
+ * sources on random-access ranges, possibly joined by concat. They are split
+ * into work units, each a slice of one source run by a copy of the pipeline
+ * where the other sources are emptied, so that the components of a concat
+ * (e.g. shards) and chunks of large components are spread over workers.
+ *
+ * par_run(rgr,red) folds each unit into a partial result of red and
+ * combines the partial results in unit order. A reducer
+ * reducer(init,identity,fold,combine) folds values as acc=fold(acc,x) and
+ * merges partial results as combine(acc1,acc2); fold and combine must be
+ * associative so that results don't depend on splitting. init is folded
+ * exactly once, by the first unit, while the others start from identity,
+ * which must satisfy combine(identity,acc)==acc (0 for sums, 1 for
+ * products, INT_MAX for the minimum of ints...). reducer(init,identity,op)
+ * uses op for both fold and combine.
+ *
+ * par_run_ordered(rgr,dst) is for sinks caring about order: units are run
+ * into buffers, 4*concurrency() units at a time, and each such wave is then
+ * pushed to dst in order from the calling thread. dst receives cursors into
+ * the buffers, and stops the run (with false returned) as it would with rgr.
+ * Both also accept a unique or unique_by stage on top of a parallel pipeline
+ * (see parallel unique below).
+ */
+
+template<typename T,typename Fold,typename Combine>
+struct reducer_class
+{
+  using result_type=T;
+
+  T       init;
+  Fold    fold;
+  Combine combine;
+  T       identity;
+};
+
+template<typename T,typename Fold,typename Combine>
+auto reducer(T init,T identity,Fold fold,Combine combine)
+{
+  return reducer_class<T,Fold,Combine>{init,fold,combine,identity};
+}
+
+template<typename T,typename Op>
+auto reducer(T init,T identity,Op op)
+{
+  return reducer_class<T,Op,Op>{init,op,op,identity};
+}
+
+template<typename Ranger>
+constexpr bool is_parallel_pipeline()
+{
+  using kind=stage_kind_t<Ranger>;
+  using stage=stage_t<Ranger>;
+
+  if constexpr(std::is_same_v<kind,all_tag>){
+    using iterator=decltype(std::declval<stage&>().first);
+
+    return
+      (std::is_same_v<stage,all_fun<iterator>>||
+       std::is_same_v<stage,all_block_fun<iterator>>)&&
+      std::random_access_iterator<iterator>;
+  }
+  else if constexpr(
+    std::is_same_v<kind,filter_tag>||std::is_same_v<kind,transform_tag>){
+    return is_parallel_pipeline<
+      std::remove_cvref_t<decltype(std::declval<stage&>().rgr)>>();
+  }
+  else if constexpr(std::is_same_v<kind,concat_tag>){
+    using next=decltype(std::declval<stage&>().next);
+
+    return
+      is_parallel_pipeline<decltype(std::declval<stage&>().rgr)>()&&
+      (!is_ranger_v<next>||is_parallel_pipeline<next>());
+  }
+  else return false;
+}
+
+template<typename Ranger,typename F>
+void for_each_source(Ranger& rgr,F& f)
+{
+  using kind=stage_kind_t<Ranger>;
+  auto& s=stage_of(rgr);
+
+  if constexpr(std::is_same_v<kind,all_tag>)f(s);
+  else if constexpr(std::is_same_v<kind,concat_tag>){
+    for_each_source(s.rgr,f);
+    if constexpr(is_ranger_v<decltype(s.next)>)for_each_source(s.next,f);
+  }
+  else for_each_source(s.rgr,f);
+}
+
+constexpr std::size_t par_min_chunk=4096;
+
+struct par_unit
+{
+  std::size_t source,first,last;
+};
+
+template<typename Ranger>
+struct par_plan
+{
+  static_assert(
+    is_parallel_pipeline<Ranger>(),
+    "parallel execution requires filter, transform and concat stages over "
+    "all() sources on random-access ranges");
+
+  par_plan(Ranger rgr_):rgr{std::move(rgr_)}
+  {
+    std::vector<std::size_t> sizes;
+    auto                     size=[&](auto& s){
+      sizes.push_back(static_cast<std::size_t>(s.last-s.first));
+    };
+    for_each_source(rgr,size);
+
+    std::size_t total=0,
+                nworkers=4*concurrency();
+    for(auto n:sizes)total+=n;
+    std::size_t chunk=std::max(par_min_chunk,(total+nworkers-1)/nworkers);
+    for(std::size_t k=0;k<sizes.size();++k){
+      std::size_t n=sizes[k],m=(n+chunk-1)/chunk;
+      for(std::size_t j=0;j<m;++j)units.push_back({k,n*j/m,n*(j+1)/m});
+    }
+    if(units.empty())units.push_back({0,0,0});
+  }
+
+  std::size_t size()const{return units.size();}
+
+  Ranger chunk(std::size_t i)const
+  {
+    auto        r=rgr;
+    auto        u=units[i];
+    std::size_t k=0;
+    auto        narrow=[&](auto& s){
+      if(k++==u.source){
+        auto first=s.first;
+
+        s.first=first+u.first;
+        s.last=first+u.last;
+      }
+      else s.first=s.last;
+    };
+    for_each_source(r,narrow);
+    return r;
+  }
+
+  template<typename Reducer,typename T>
+  static T fold(Ranger r,const Reducer& red,T acc)
+  {
+    r([&](auto p){acc=red.fold(std::move(acc),*p);return true;});
+    return acc;
+  }
+
+  template<typename Reducer>
+  auto reduce(std::size_t i,const Reducer& red)const
+  {
+    return fold(chunk(i),red,i==0?red.init:red.identity);
+  }
+
+  template<typename Reducer,typename Partials>
+  static auto combine(const Reducer& red,Partials& partials)
+  {
+    auto acc=std::move(partials[0]);
+    for(std::size_t i=1;i<partials.size();++i){
+      acc=red.combine(std::move(acc),std::move(partials[i]));
+    }
+    return acc;
+  }
+
+  Ranger                rgr;
+  std::vector<par_unit> units;
+};
+
+/* radix_partition(bits,key_fn,x) distributes the elements of x into 2^bits
+ * partitions according to the low bits of key_fn(element) (typically a
+ * hash), so that hash-based operators can process each partition on its own
+ * worker. x is either a random-access range or a ranger. Random-access
+ * ranges and parallel pipelines are split into chunks (the work units of
+ * the pipeline) histogrammed and scattered in parallel, each chunk being
+ * traversed twice; other rangers are traversed twice sequentially, the
+ * histogram pass running on a copy. Scattering goes through small
+ * per-partition buffers flushed a cache line at a time. Relative order of
+ * elements is preserved within each partition.
+ */
+
+template<typename T>
+struct radix_partitions
+{
+  std::size_t size()const{return offsets.size()-1;}
+
+  auto operator[](std::size_t i)const
+  {
+    return all(std::span<const T>(
+      data.data()+offsets[i],offsets[i+1]-offsets[i]));
+  }
+
+  std::vector<T>           data;
+  std::vector<std::size_t> offsets;
+};
+
+template<typename T,typename KeyFn>
+struct radix_scatter
+{
+  static constexpr std::size_t buffer_size=
+    sizeof(T)>=64?1:64/sizeof(T)<4?4:64/sizeof(T);
+
+  radix_scatter(std::size_t bits,KeyFn& key_fn,T* out,std::size_t* pos):
+    mask{(std::size_t(1)<<bits)-1},key_fn{key_fn},out{out},pos{pos},
+    buf((mask+1)*buffer_size),fill(mask+1,0){}
+
+  void operator()(const T& x)
+  {
+    auto k=static_cast<std::size_t>(key_fn(x))&mask;
+    buf[k*buffer_size+fill[k]++]=x;
+    if(fill[k]==buffer_size)flush(k);
+  }
+
+  void flush()
+  {
+    for(std::size_t k=0;k<=mask;++k)flush(k);
+  }
+
+  void flush(std::size_t k)
+  {
+    auto first=buf.begin()+k*buffer_size;
+    std::copy(first,first+fill[k],out+pos[k]);
+    pos[k]+=fill[k];
+    fill[k]=0;
+  }
+
+  std::size_t              mask;
+  KeyFn&                   key_fn;
+  T*                       out;
+  std::size_t*             pos;
+  std::vector<T>           buf;
+  std::vector<std::size_t> fill;
+};
+
+/* partitions the nchunks rangers returned by chunk(i) in parallel */
+
+template<typename T,typename KeyFn,typename Chunk>
+radix_partitions<T> radix_partition_chunks(
+  std::size_t bits,KeyFn& key_fn,std::size_t nchunks,Chunk chunk)
+{
+  std::size_t              mask=(std::size_t(1)<<bits)-1,
+                           nparts=mask+1;
+  radix_partitions<T>      res;
+  std::vector<std::size_t> pos(nchunks*nparts,0);
+
+  parallel_for(nchunks,[&](std::size_t i){
+    auto cpos=pos.data()+i*nparts;
+    chunk(i)([&](auto p){
+      ++cpos[static_cast<std::size_t>(key_fn(*p))&mask];
+      return true;
+    });
+  });
+  res.offsets.resize(nparts+1);
+  std::size_t acc=0;
+  for(std::size_t k=0;k<nparts;++k){
+    res.offsets[k]=acc;
+    for(std::size_t i=0;i<nchunks;++i){
+      auto c=pos[i*nparts+k];
+      pos[i*nparts+k]=acc;
+      acc+=c;
+    }
+  }
+  res.offsets[nparts]=acc;
+  res.data.resize(acc);
+  parallel_for(nchunks,[&](std::size_t i){
+    radix_scatter<T,KeyFn> scatter{
+      bits,key_fn,res.data.data(),pos.data()+i*nparts};
+    chunk(i)([&](auto p){scatter(*p);return true;});
+    scatter.flush();
+  });
+  return res;
+}
+
+template<typename KeyFn,typename X>
+auto radix_partition(std::size_t bits,KeyFn key_fn,X&& x)
+{
+  using std::begin;
+  using std::end;
+  using type=std::remove_cvref_t<X>;
+
+  if constexpr(is_ranger_v<type>){
+    using value_type=std::remove_cvref_t<
+      decltype(*std::declval<typename type::cursor>())>;
+
+    if constexpr(is_parallel_pipeline<type>()){
+      par_plan<type> plan{x};
+
+      return radix_partition_chunks<value_type>(
+        bits,key_fn,plan.size(),[&](std::size_t i){return plan.chunk(i);});
+    }
+    else{
+      std::size_t                  mask=(std::size_t(1)<<bits)-1;
+      radix_partitions<value_type> res;
+      std::vector<std::size_t>     pos(mask+2,0);
+      auto                         rgr=x,hrgr=x;
+
+      hrgr([&](auto p){
+        ++pos[(static_cast<std::size_t>(key_fn(*p))&mask)+1];
+        return true;
+      });
+      for(std::size_t k=1;k<pos.size();++k)pos[k]+=pos[k-1];
+      res.offsets=pos;
+      res.data.resize(pos.back());
+      radix_scatter<value_type,KeyFn> scatter{
+        bits,key_fn,res.data.data(),pos.data()};
+      rgr([&](auto p){scatter(*p);return true;});
+      scatter.flush();
+      return res;
+    }
+  }
+  else{
+    using value_type=std::remove_cvref_t<decltype(*begin(x))>;
+
+    std::size_t nparts=std::size_t(1)<<bits,
+                n=static_cast<std::size_t>(end(x)-begin(x)),
+                nchunks=std::max<std::size_t>(
+                  1,std::min(concurrency(),n/nparts));
+
+    return radix_partition_chunks<value_type>(
+      bits,key_fn,nchunks,[&](std::size_t i){
+        return all(std::ranges::subrange(
+          begin(x)+n*i/nchunks,begin(x)+n*(i+1)/nchunks));
+      });
+  }
+}
+
+/* Backends for par_run, selected as par_run<Backend>(rgr,red) or, for
+ * par_run(rgr,red), by defining TRANSRANGERS_PAR_BACKEND (builtin_backend by
+ * default). A backend's run(n,f) calls f(0),...,f(n-1) in parallel; it can
+ * also provide its own reduce(plan,red).
+ *   - builtin_backend runs on parallel_for.
+ *   - openmp_backend, available when compiling with OpenMP, runs on an
+ *     OpenMP parallel for loop. Partial results are combined afterwards
+ *     rather than through a reduction clause so that combine is applied in
+ *     unit order.
+ *   - tbb_backend, enabled by defining TRANSRANGERS_TBB (the program must
+ *     then link against TBB), reduces with tbb::parallel_reduce.
+ */
+
+struct builtin_backend
+{
+  template<typename F>
+  static void run(std::size_t n,F f)
+  {
+    parallel_for(n,f);
+  }
+};
+
+#if defined(_OPENMP)
+struct openmp_backend
+{
+  template<typename F>
+  static void run(std::size_t n,F f)
+  {
+    auto m=static_cast<std::ptrdiff_t>(n);
+
+#pragma omp parallel for schedule(dynamic) if(m>1)
+    for(std::ptrdiff_t i=0;i<m;++i)f(static_cast<std::size_t>(i));
+  }
+};
+#endif
+
+#if defined(TRANSRANGERS_TBB)
+struct tbb_backend
+{
+  template<typename F>
+  static void run(std::size_t n,F f)
+  {
+    tbb::parallel_for(std::size_t(0),n,f);
+  }
+
+  template<typename Ranger,typename Reducer>
+  static auto reduce(const par_plan<Ranger>& plan,const Reducer& red)
+  {
+    using result_type=typename Reducer::result_type;
+
+    return red.combine(red.init,tbb::parallel_reduce(
+      tbb::blocked_range<std::size_t>(0,plan.size(),1),red.identity,
+      [&](const tbb::blocked_range<std::size_t>& r,result_type acc){
+        for(auto i=r.begin();i!=r.end();++i){
+          acc=plan.fold(plan.chunk(i),red,std::move(acc));
+        }
+        return acc;
+      },
+      [&](result_type x,result_type y){
+        return red.combine(std::move(x),std::move(y));
+      }));
+  }
+};
+#endif
+
+#if defined(TRANSRANGERS_PAR_BACKEND)
+using default_par_backend=TRANSRANGERS_PAR_BACKEND;
+#else
+using default_par_backend=builtin_backend;
+#endif
+
+/* Parallel unique. unique(rgr) and unique_by(key_fn,rgr) over a parallel
+ * pipeline rgr deduplicate each unit of rgr on its own: the only duplicates
+ * missed are the first elements of units whose key equals the last key of
+ * the preceding nonempty unit, which are dropped afterwards when stitching
+ * units together in order.
+ */
+
+template<typename Ranger>
+constexpr bool is_unique_pipeline()
+{
+  using kind=stage_kind_t<Ranger>;
+
+  return std::is_same_v<kind,unique_tag>||std::is_same_v<kind,unique_by_tag>;
+}
+
+template<typename Ranger>
+auto unique_key_fn(Ranger& rgr)
+{
+  if constexpr(std::is_same_v<stage_kind_t<Ranger>,unique_by_tag>){
+    return stage_of(rgr).key_fn;
+  }
+  else return [](const auto& x){return x;};
+}
+
+template<typename Ranger>
+using unique_source_t=decltype(stage_of(std::declval<Ranger&>()).rgr);
+
+/* runs unit i of plan deduplicated, calling f(x,first) for each survivor */
+
+template<typename Plan,typename KeyFn,typename Key,typename F>
+void unique_unit(
+  const Plan& plan,std::size_t i,KeyFn& key_fn,std::optional<Key>& last,F f)
+{
+  plan.chunk(i)([&](auto p){
+    decltype(auto) x=*p;
+    auto           key=key_fn(x);
+    if(!last){
+      last.emplace(std::move(key));
+      f(x,true);
+    }
+    else if(!(*last==key)){
+      *last=std::move(key);
+      f(x,false);
+    }
+    return true;
+  });
+}
+
+/* Reductions of a parallel pipeline rgr by red, run as
+ * partials=reduction.partials(), then reduction.run(i,partials) for each
+ * unit i in any order or concurrently, then reduction.combine(partials).
+ */
+
+template<typename Ranger,typename Reducer>
+struct par_reduction
+{
+  using result_type=typename Reducer::result_type;
+  using partials_type=std::vector<result_type>;
+
+  par_reduction(Ranger rgr,Reducer red):plan{std::move(rgr)},red{red}{}
+
+  std::size_t size()const{return plan.size();}
+
+  partials_type partials()const
+  {
+    return partials_type(size(),red.identity);
+  }
+
+  void run(std::size_t i,partials_type& partials)const
+  {
+    partials[i]=plan.reduce(i,red);
+  }
+
+  result_type combine(partials_type& partials)const
+  {
+    return plan.combine(red,partials);
+  }
+
+  par_plan<Ranger> plan;
+  Reducer          red;
+};
+
+template<typename Ranger,typename Reducer>
+struct unique_reduction
+{
+  using source=unique_source_t<Ranger>;
+  using result_type=typename Reducer::result_type;
+  using key_fn_type=decltype(unique_key_fn(std::declval<Ranger&>()));
+  using key_type=std::remove_cvref_t<std::invoke_result_t<
+    key_fn_type&,decltype(*std::declval<typename source::cursor&>())>>;
+
+  struct part
+  {
+    std::optional<key_type> first,last;
+    result_type             head,rest;
+  };
+
+  using partials_type=std::vector<part>;
+
+  unique_reduction(Ranger rgr,Reducer red):
+    key_fn{unique_key_fn(rgr)},plan{stage_of(rgr).rgr},red{red}{}
+
+  std::size_t size()const{return plan.size();}
+
+  partials_type partials()const
+  {
+    return partials_type(size(),part{{},{},red.identity,red.identity});
+  }
+
+  void run(std::size_t i,partials_type& partials)const
+  {
+    auto& pt=partials[i];
+    auto  kf=key_fn;
+    unique_unit(plan,i,kf,pt.last,[&](const auto& x,bool first){
+      if(first){
+        pt.first=pt.last;
+        pt.head=red.fold(std::move(pt.head),x);
+      }
+      else pt.rest=red.fold(std::move(pt.rest),x);
+    });
+  }
+
+  result_type combine(partials_type& partials)const
+  {
+    result_type acc=red.init;
+    const part* prev=nullptr;
+    for(auto& pt:partials){
+      if(!pt.first)continue;
+      if(!(prev&&*prev->last==*pt.first)){
+        acc=red.combine(std::move(acc),std::move(pt.head));
+      }
+      acc=red.combine(std::move(acc),std::move(pt.rest));
+      prev=&pt;
+    }
+    return acc;
+  }
+
+  key_fn_type      key_fn;
+  par_plan<source> plan;
+  Reducer          red;
+};
+
+template<typename Ranger,typename Reducer>
+auto make_par_reduction(Ranger rgr,Reducer red)
+{
+  if constexpr(is_unique_pipeline<Ranger>()){
+    return unique_reduction<Ranger,Reducer>{rgr,red};
+  }
+  else return par_reduction<Ranger,Reducer>{rgr,red};
+}
+
+template<
+  typename Backend=default_par_backend,typename Ranger,typename Reducer
+>
+auto par_run(Ranger rgr,Reducer red)
+{
+  auto reduction=make_par_reduction(rgr,red);
+
+  if constexpr(
+    !is_unique_pipeline<Ranger>()&&
+    requires{Backend::reduce(reduction.plan,red);}){
+    return Backend::reduce(reduction.plan,red);
+  }
+  else{
+    auto partials=reduction.partials();
+
+    Backend::run(reduction.size(),[&](std::size_t i){
+      reduction.run(i,partials);
+    });
+    return reduction.combine(partials);
+  }
+}
+
+/* runs fill(unit,slot) for n units, par_wave_size() at a time, draining
+ * each wave's slots in order with drain(slot) until it returns false.
+ */
+
+inline std::size_t par_wave_size(){return 4*concurrency();}
+
+template<typename Backend,typename Fill,typename Drain>
+bool par_waves(std::size_t n,Fill fill,Drain drain)
+{
+  std::size_t wave=par_wave_size();
+
+  for(std::size_t i=0;i<n;i+=wave){
+    std::size_t m=std::min(wave,n-i);
+
+    Backend::run(m,[&](std::size_t j){fill(i+j,j);});
+    for(std::size_t j=0;j<m;++j)if(!drain(j))return false;
+  }
+  return true;
+}
+
+template<typename Backend,typename Ranger,typename Dst>
+bool par_run_ordered_unique(Ranger rgr,Dst& dst)
+{
+  using source=unique_source_t<Ranger>;
+  using value_type=std::remove_cvref_t<
+    decltype(*std::declval<typename Ranger::cursor&>())>;
+
+  auto key_fn=unique_key_fn(rgr);
+  using key_type=decltype(key_fn(std::declval<const value_type&>()));
+
+  par_plan<source>                     plan{stage_of(rgr).rgr};
+  std::size_t                          nslots=
+    std::min(par_wave_size(),plan.size());
+  std::vector<std::vector<value_type>> buffers(nslots);
+  std::vector<std::optional<key_type>> lasts(nslots);
+  std::optional<key_type>              prev;
+
+  return par_waves<Backend>(
+    plan.size(),
+    [&](std::size_t i,std::size_t j){
+      auto& buf=buffers[j];
+      auto  kf=key_fn;
+      buf.clear();
+      lasts[j].reset();
+      unique_unit(plan,i,kf,lasts[j],[&](const auto& x,bool){
+        buf.push_back(x);
+      });
+    },
+    [&](std::size_t j){
+      auto first=buffers[j].cbegin(),last=buffers[j].cend();
+      if(first==last)return true;
+      if(prev&&*prev==key_fn(*first))++first;
+      prev=std::move(lasts[j]);
+      for(;first!=last;++first)if(!dst(first))return false;
+      return true;
+    });
+}
+
+template<typename Backend=default_par_backend,typename Ranger,typename Dst>
+bool par_run_ordered(Ranger rgr,Dst dst)
+{
+  if constexpr(is_unique_pipeline<Ranger>()){
+    return par_run_ordered_unique<Backend>(rgr,dst);
+  }
+  else{
+    using value_type=std::remove_cvref_t<
+      decltype(*std::declval<typename Ranger::cursor&>())>;
+
+    par_plan<Ranger>                     plan{rgr};
+    std::vector<std::vector<value_type>> buffers(
+      std::min(par_wave_size(),plan.size()));
+
+    return par_waves<Backend>(
+      plan.size(),
+      [&](std::size_t i,std::size_t j){
+        auto& buf=buffers[j];
+        buf.clear();
+        plan.chunk(i)([&](auto p){buf.push_back(*p);return true;});
+      },
+      [&](std::size_t j){
+        for(auto first=buffers[j].cbegin(),last=buffers[j].cend();
+            first!=last;++first){
+          if(!dst(first))return false;
+        }
+        return true;
+      });
+  }
+}
+
+/* par_chunk_by(pred,rgr,red) splits the values of a parallel pipeline rgr
+ * into runs, a new run starting where pred(previous,current) is false (as
+ * with std::views::chunk_by), and returns a vector with the reduction by red
+ * of each run. Units are split into runs on their own; when stitching them
+ * in order, the first run of a unit is merged by red.combine into the last
+ * run so far if pred holds across the boundary. Each run folds red.init
+ * once: first runs of units start from red.identity and get red.init
+ * combined in front only when they aren't merged.
+ */
+
+template<
+  typename Backend=default_par_backend,
+  typename Pred,typename Ranger,typename Reducer
+>
+auto par_chunk_by(Pred pred,Ranger rgr,Reducer red)
+{
+  using value_type=std::remove_cvref_t<
+    decltype(*std::declval<typename Ranger::cursor&>())>;
+  using result_type=typename Reducer::result_type;
+
+  struct part
+  {
+    std::optional<value_type> first,last;
+    std::vector<result_type>  runs;
+  };
+
+  par_plan<Ranger>  plan{rgr};
+  std::vector<part> parts(plan.size());
+
+  Backend::run(plan.size(),[&](std::size_t i){
+    auto& pt=parts[i];
+    plan.chunk(i)([&](auto p){
+      decltype(auto) x=*p;
+      if(!pt.last){
+        pt.first.emplace(x);
+        pt.runs.push_back(red.identity);
+      }
+      else if(!pred(*pt.last,x))pt.runs.push_back(red.init);
+      pt.runs.back()=red.fold(std::move(pt.runs.back()),x);
+      pt.last=x;
+      return true;
+    });
+  });
+
+  std::vector<result_type> res;
+  const part*              prev=nullptr;
+  for(auto& pt:parts){
+    if(!pt.first)continue;
+    auto first=pt.runs.begin();
+    if(prev&&pred(*prev->last,*pt.first)){
+      res.back()=red.combine(std::move(res.back()),std::move(*first));
+    }
+    else res.push_back(red.combine(red.init,std::move(*first)));
+    ++first;
+    res.insert(
+      res.end(),std::make_move_iterator(first),
+      std::make_move_iterator(pt.runs.end()));
+    prev=&pt;
+  }
+  return res;
+}
+
+#if defined(TRANSRANGERS_EXECUTION)
+/* par_run(sched,rgr,red) is par_run(rgr,red) as a sender, enabled by
+ * defining TRANSRANGERS_SENDERS (with stdexec if available, otherwise
+ * std::execution, whose bulk must take an execution policy): units are run
+ * by a bulk sender on sched and their results combined in a continuation,
+ * so nothing blocks until the caller decides to and the work composes with
+ * the scheduler's own continuations. Units don't check for stop requests:
+ * once the bulk stage starts, all of them are run.
+ */
+
+template<typename Scheduler,typename Ranger,typename Reducer>
+auto par_run(Scheduler sched,Ranger rgr,Reducer red)
+{
+  namespace ex=TRANSRANGERS_EXECUTION;
+
+  auto reduction=make_par_reduction(rgr,red);
+
+  return
+    ex::schedule(sched)|
+    ex::then([=]{return reduction.partials();})|
+    ex::bulk(ex::par,reduction.size(),[=](std::size_t i,auto& partials){
+      reduction.run(i,partials);
+    })|
+    ex::then([=](auto&& partials){return reduction.combine(partials);});
+}
+#endif
+
+} /* namespace transrangers */
+
+#undef TRANSRANGERS_EXECUTION
+#endif
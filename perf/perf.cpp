@@ -10,14 +10,21 @@
 
 #include <algorithm>
 #include <benchmark/benchmark.h>
+#include <cmath>
 #include <functional>
 #include <numeric>
+#include <random>
+#include <ranges>
+#include <span>
 #include <range/v3/numeric/accumulate.hpp>
 #include <range/v3/view/concat.hpp>
 #include <range/v3/view/filter.hpp>
 #include <range/v3/view/take.hpp>
 #include <range/v3/view/transform.hpp>
+#include <range/v3/view/unique.hpp>
+#include <string>
 #include <transrangers.hpp>
+#include <transrangers_parallel.hpp>
 #include <vector>
 
 auto rng=[]{
@@ -109,4 +116,355 @@ static void test2_rangev3(benchmark::State& st)
 }
 BENCHMARK(test2_rangev3);
 
+auto rngf=[]{
+  std::vector<float> rng(1000000);
+  std::iota(rng.begin(),rng.end(),0.0f);
+  return rng;
+}();
+
+auto x3f=[](float x){return 3.0f*x;};
+
+static void test3_handwritten(benchmark::State& st)
+{
+  for (auto _:st){
+    int res=0;
+    for(auto x:rng)res+=x3(x);
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test3_handwritten);
+
+static void test3_transrangers(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace transrangers;
+      
+    int  res=0;
+    auto rgr=transform(x3,all(rng));
+    rgr([&](auto p){res+=*p;return true;});
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test3_transrangers);
+
+static void test3_transrangers_block(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace transrangers;
+      
+    int  res=0;
+    auto rgr=block_transform(x3,all(rng));
+    rgr([&](auto p){res+=*p;return true;});
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test3_transrangers_block);
+
+static void test3_rangev3(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace ranges::views;
+
+    volatile auto res=ranges::accumulate(rng|transform(x3),0);
+  }
+}
+BENCHMARK(test3_rangev3);
+
+static void test4_handwritten(benchmark::State& st)
+{
+  for (auto _:st){
+    float res=0;
+    for(auto x:rngf)res+=x3f(x);
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test4_handwritten);
+
+static void test4_transrangers(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace transrangers;
+      
+    float res=0;
+    auto  rgr=transform(x3f,all(rngf));
+    rgr([&](auto p){res+=*p;return true;});
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test4_transrangers);
+
+static void test4_transrangers_block(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace transrangers;
+      
+    float res=0;
+    auto  rgr=block_transform(x3f,all(rngf));
+    rgr([&](auto p){res+=*p;return true;});
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test4_transrangers_block);
+
+static void test4_rangev3(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace ranges::views;
+
+    volatile auto res=ranges::accumulate(rngf|transform(x3f),0.0f);
+  }
+}
+BENCHMARK(test4_rangev3);
+
+auto expensive=[](int x){return static_cast<int>(std::sqrt(std::sqrt(x)));};
+
+static void test5_handwritten(benchmark::State& st)
+{
+  for (auto _:st){
+    int  res=0,prev=0;
+    bool start=true;
+    for(auto x:rng){
+      if(is_even(x)){
+        auto y=expensive(x);
+        if(start||y!=prev){
+          res+=y;
+          prev=y;
+          start=false;
+        }
+      }
+    }
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test5_handwritten);
+
+static void test5_transrangers(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace transrangers;
+      
+    int  res=0;
+    auto rgr=unique(transform(expensive,filter(is_even,all(rng))));
+    rgr([&](auto p){res+=*p;return true;});
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test5_transrangers);
+
+static void test5_rangev3(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace ranges::views;
+
+    volatile auto res=ranges::accumulate(
+      rng|filter(is_even)|transform(expensive)|unique,0);
+  }
+}
+BENCHMARK(test5_rangev3);
+
+/* small batches processed by a pipeline whose function carries state */
+
+auto lut=[]{
+  std::vector<int> lut(256);
+  std::iota(lut.begin(),lut.end(),0);
+  return lut;
+}();
+
+constexpr std::size_t batch_size=16;
+
+auto batch(std::size_t i)
+{
+  return std::ranges::subrange(rng.begin()+i,rng.begin()+i+batch_size);
+}
+
+static void test6_handwritten(benchmark::State& st)
+{
+  for (auto _:st){
+    int res=0;
+    for(std::size_t i=0;i+batch_size<=rng.size();i+=batch_size){
+      int m=8;
+      for(auto x:batch(i)){
+        if(is_even(x)){
+          res+=lut[x%256];
+          if(!--m)break;
+        }
+      }
+    }
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test6_handwritten);
+
+static void test6_transrangers(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace transrangers;
+      
+    int res=0;
+    for(std::size_t i=0;i+batch_size<=rng.size();i+=batch_size){
+      auto rgr=take(8,transform(
+        [lut=lut](int x){return lut[x%256];},filter(is_even,all(batch(i)))));
+      rgr([&](auto p){res+=*p;return true;});
+    }
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test6_transrangers);
+
+static void test6_transrangers_rebind(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace transrangers;
+      
+    int  res=0;
+    auto rgr=take(8,transform(
+      [lut=lut](int x){return lut[x%256];},filter(is_even,all(batch(0)))));
+    for(std::size_t i=0;i+batch_size<=rng.size();i+=batch_size){
+      rebind(rgr,batch(i))([&](auto p){res+=*p;return true;});
+    }
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test6_transrangers_rebind);
+
+static void test6_rangev3(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace ranges::views;
+
+    int res=0;
+    for(std::size_t i=0;i+batch_size<=rng.size();i+=batch_size){
+      res+=ranges::accumulate(
+        batch(i)|filter(is_even)|
+        transform([lut=lut](int x){return lut[x%256];})|take(8),0);
+    }
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test6_rangev3);
+
+/* parallel reduction backends on small and large inputs; build with
+ * -fopenmp and/or -DTRANSRANGERS_TBB (linking TBB) to include them all.
+ */
+
+auto prefix(std::size_t n)
+{
+  return std::span<const int>(rng.data(),n);
+}
+
+static void test7_handwritten(benchmark::State& st)
+{
+  for (auto _:st){
+    long long res=0;
+    for(auto x:prefix(st.range(0))){
+      if(is_even(x))res+=x3(x);
+    }
+    volatile auto res2=res;
+  }
+}
+BENCHMARK(test7_handwritten)->Arg(1000)->Arg(1000000);
+
+template<typename Backend>
+static void test7_transrangers_par(benchmark::State& st)
+{
+  for (auto _:st){
+    using namespace transrangers;
+
+    auto res=par_run<Backend>(
+      transform(x3,filter(is_even,all(prefix(st.range(0))))),
+      reducer(0LL,0LL,std::plus<>{}));
+    volatile auto res2=res;
+  }
+}
+BENCHMARK_TEMPLATE(test7_transrangers_par,transrangers::builtin_backend)->
+  Arg(1000)->Arg(1000000);
+#if defined(_OPENMP)
+BENCHMARK_TEMPLATE(test7_transrangers_par,transrangers::openmp_backend)->
+  Arg(1000)->Arg(1000000);
+#endif
+#if defined(TRANSRANGERS_TBB)
+BENCHMARK_TEMPLATE(test7_transrangers_par,transrangers::tbb_backend)->
+  Arg(1000)->Arg(1000000);
+#endif
+
+/* filtering unpredictable data into a vector across selectivities
+ * (percentage of elements passing the predicate)
+ */
+
+auto rndm=[]{
+  std::vector<int> rndm(1000000);
+  std::mt19937     gen(1);
+  for(auto& x:rndm)x=static_cast<int>(gen()%100);
+  return rndm;
+}();
+
+static void test8_handwritten(benchmark::State& st)
+{
+  int sel=static_cast<int>(st.range(0));
+  for (auto _:st){
+    std::vector<int> res;
+    res.reserve(rndm.size());
+    for(auto x:rndm){
+      if(x<sel)res.push_back(x);
+    }
+    volatile auto res2=res.size();
+  }
+}
+BENCHMARK(test8_handwritten)->DenseRange(0,100,10);
+
+static void test8_transrangers(benchmark::State& st)
+{
+  int sel=static_cast<int>(st.range(0));
+  for (auto _:st){
+    using namespace transrangers;
+
+    std::vector<int> res;
+    res.reserve(rndm.size());
+    auto rgr=filter([=](int x){return x<sel;},all(rndm));
+    rgr([&](auto p){res.push_back(*p);return true;});
+    volatile auto res2=res.size();
+  }
+}
+BENCHMARK(test8_transrangers)->DenseRange(0,100,10);
+
+static void test8_transrangers_branchless(benchmark::State& st)
+{
+  int sel=static_cast<int>(st.range(0));
+  for (auto _:st){
+    using namespace transrangers;
+
+    std::vector<int> res;
+    res.reserve(rndm.size());
+    auto rgr=branchless_filter([=](int x){return x<sel;},all(rndm));
+    rgr([&](auto p){res.push_back(*p);return true;});
+    volatile auto res2=res.size();
+  }
+}
+BENCHMARK(test8_transrangers_branchless)->DenseRange(0,100,10);
+
+/* counting over a whole range at each runtime ISA level */
+
+static void test9_handwritten(benchmark::State& st)
+{
+  for (auto _:st){
+    volatile auto res=std::count_if(
+      rndm.begin(),rndm.end(),[](int x){return x>=20&&x<=40;});
+  }
+}
+BENCHMARK(test9_handwritten);
+
+static void test9_transrangers_isa(benchmark::State& st)
+{
+  using namespace transrangers;
+
+  force_isa_level(isa_level(st.range(0)));
+  st.SetLabel(
+    "isa level "+std::to_string(static_cast<int>(current_isa_level())));
+  for (auto _:st){
+    volatile auto res=count_if(between(20,40),all(rndm));
+  }
+  force_isa_level(isa_level::avx512);
+}
+BENCHMARK(test9_transrangers_isa)->DenseRange(0,2);
+
 BENCHMARK_MAIN();